@@ -0,0 +1,588 @@
+#include "allocator.h"
+#include "common.h"
+
+#include <iostream>
+#include <sstream>
+#include <limits>
+#include <set>
+#include <queue>
+#include <tuple>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace std;
+
+
+void MaxMinAllocator::allocate(vector<Flow*>& flows){
+    set<Flow*> activeFlows(flows.begin(), flows.end());
+    // update flow throughput
+    for(auto flow : activeFlows){
+        flow->throughput = 0;
+        flow->bottleneck = nullptr;
+    }
+
+    // collective active links
+    set<Link*> activeLinks;
+    for(auto flow : activeFlows){
+        for(auto share : flow->linkShares){
+            activeLinks.insert(share.first);
+        }
+    }
+
+    // update link throughput
+    for(auto link : activeLinks){
+        link->throughput = 0;
+        link->load = 0;
+        link->flows.clear();
+    }
+
+    // update link flows
+    for(auto flow : activeFlows){
+        for(auto share : flow->linkShares){
+            share.first->flows.insert(flow);
+            share.first->load += share.second;
+        }
+    }
+
+    // update throughput
+    while(!activeFlows.empty() && !activeLinks.empty()) { // water filling
+        // iterate links to get minimum throughput
+        double minAug = numeric_limits<double>::infinity();
+        for(auto link : activeLinks) {
+            double aug = (link->capacity - link->throughput)/link->load;
+            if(aug < minAug) {
+                minAug = aug;
+            }
+        }
+        // update flows
+        for(auto flow : activeFlows) {
+            flow->throughput += minAug;
+        }
+        // update links
+        for(auto link : activeLinks) {
+            link->throughput += minAug * link->load;
+        }
+        // freeze link
+        set<Link*> frozenLinks;
+        for(auto link : activeLinks) {
+            if(link->throughput >= link->capacity * (1 - 1e-12)) {  // saturated up to rounding
+                frozenLinks.insert(link);
+            }
+        }
+        // freeze flows
+        set<Flow*> frozenFlows;
+        for(auto link : frozenLinks) {
+            for(auto flow : link->flows) {
+                frozenFlows.insert(flow);
+                if(flow->bottleneck == nullptr) flow->bottleneck = link;
+            }
+        }
+        // freeze flows in the same collective
+        for(auto flow : frozenFlows) {
+            for(auto other : flow->collective->flows) {
+                if(other != flow) {
+                    frozenFlows.insert(other);
+                    if(other->bottleneck == nullptr) other->bottleneck = flow->bottleneck;
+                }
+            }
+        }
+        // remove frozen flows
+        for(auto flow : frozenFlows) {
+            activeFlows.erase(flow);
+        }
+        // remove frozen links
+        for(auto link : frozenLinks) {
+            activeLinks.erase(link);
+        }
+    }
+
+    // if active flows is not empty, it is internal, it completes immediately
+    for(auto flow : activeFlows) {
+        flow->throughput = numeric_limits<double>::infinity();
+        // flow->remainingSize = 0;
+    }
+}
+
+
+// The sequential version walks sets ordered by address: flows and links are
+// indexed in that order here, loads are summed in it, a flow's bottleneck is
+// its lowest frozen link and the flows a collective freezes along take the
+// bottleneck of its lowest directly frozen flow.
+void ParallelMaxMinAllocator::allocate(vector<Flow*>& all){
+    vector<Flow*> flows(all.begin(), all.end());
+    sort(flows.begin(), flows.end());
+    flows.erase(unique(flows.begin(), flows.end()), flows.end());
+    vector<Link*> links;
+    for(auto flow : flows) {
+        for(auto share : flow->linkShares) {
+            links.push_back(share.first);
+        }
+    }
+    sort(links.begin(), links.end());
+    links.erase(unique(links.begin(), links.end()), links.end());
+    for(auto link : links) {
+        link->load = 0;
+    }
+    for(auto flow : flows) {
+        for(auto share : flow->linkShares) {
+            share.first->load += share.second;
+        }
+    }
+    fill(flows, links);
+}
+
+void ParallelMaxMinAllocator::fill(vector<Flow*>& flows, vector<Link*>& links){
+    int F = flows.size(), L = links.size();
+    unordered_map<Link*, int> linkIndex;
+    linkIndex.reserve(L);
+    for(int l = 0; l < L; ++l) {
+        linkIndex[links[l]] = l;
+        links[l]->throughput = 0;
+    }
+
+    // flow -> links in share order, collective -> flows in flow order
+    vector<int> linkStart(F + 1, 0), linksOf;
+    vector<Collective*> collectives;
+    vector<vector<int>> members;
+    unordered_map<Collective*, int> unitIndex;
+    for(int f = 0; f < F; ++f) {
+        flows[f]->throughput = 0;
+        flows[f]->bottleneck = nullptr;
+        for(auto share : flows[f]->linkShares) {
+            linksOf.push_back(linkIndex[share.first]);
+        }
+        linkStart[f + 1] = linksOf.size();
+        auto it = unitIndex.find(flows[f]->collective);
+        if(it == unitIndex.end()) {
+            it = unitIndex.insert(make_pair(flows[f]->collective, (int)collectives.size())).first;
+            collectives.push_back(flows[f]->collective);
+            members.push_back(vector<int>());
+        }
+        members[it->second].push_back(f);
+    }
+    vector<double> rate(F, 0), throughput(L, 0), capacity(L), load(L);
+    for(int l = 0; l < L; ++l) {
+        capacity[l] = links[l]->capacity;
+        load[l] = links[l]->load;
+    }
+
+    // link -> flows in flow order
+    vector<int> flowStart(L + 1, 0), flowsOf(linksOf.size());
+    for(auto l : linksOf) flowStart[l + 1]++;
+    for(int l = 0; l < L; ++l) flowStart[l + 1] += flowStart[l];
+    vector<int> next(flowStart.begin(), flowStart.end() - 1);
+    for(int f = 0; f < F; ++f) {
+        for(int k = linkStart[f]; k < linkStart[f + 1]; ++k) {
+            flowsOf[next[linksOf[k]]++] = f;
+        }
+    }
+
+    // Every active flow gains the same minAug in a filling round, so a flow
+    // frozen in a round gets the sum of the rounds' minima so far, `level`.
+    // One pass over the active links applies the last round's minAug,
+    // freezes the saturated links and takes the next minimum; the flows of
+    // the links that froze are then frozen in link order, each once.
+    vector<int> activeLinks(L);
+    for(int l = 0; l < L; ++l) activeLinks[l] = l;
+    vector<char> frozenFlow(F, 0), frozenLink(L, 0), frozenCollective(collectives.size(), 0);
+    int activeFlows = F;
+    double level = 0, minAug = 0;
+    bool filled = false;    // minAug is still to be applied to the links
+    vector<double> partial;
+    vector<vector<int>> saturated;
+    while(true) {   // water filling
+        int parts = pool->chunks(activeLinks.size());
+        partial.assign(parts, numeric_limits<double>::infinity());
+        saturated.assign(parts, vector<int>());
+        pool->run(activeLinks.size(), [&](int begin, int end, int chunk) {
+            double least = numeric_limits<double>::infinity();
+            for(int i = begin; i < end; ++i) {
+                int l = activeLinks[i];
+                if(filled) {
+                    throughput[l] += minAug * load[l];
+                    frozenLink[l] = throughput[l] >= capacity[l] * (1 - 1e-12);
+                    if(frozenLink[l]) {
+                        saturated[chunk].push_back(l);
+                        continue;
+                    }
+                }
+                double aug = (capacity[l] - throughput[l]) / load[l];
+                if(aug < least) least = aug;
+            }
+            partial[chunk] = least;
+        });
+        if(filled) {
+            vector<int> touched;    // collectives of the flows a link froze in this round
+            for(auto& chunk : saturated) {
+                for(auto l : chunk) {
+                    for(int k = flowStart[l]; k < flowStart[l + 1]; ++k) {
+                        int f = flowsOf[k];
+                        if(frozenFlow[f]) continue;
+                        frozenFlow[f] = 1;
+                        flows[f]->bottleneck = links[l];
+                        int c = unitIndex[flows[f]->collective];
+                        if(!frozenCollective[c]) {
+                            frozenCollective[c] = 1;
+                            touched.push_back(c);
+                        }
+                    }
+                }
+            }
+            // freeze flows in the same collective
+            for(auto c : touched) {
+                Flow* first = nullptr;
+                for(auto f : members[c]) {
+                    if(frozenFlow[f]) {     // before this round, the whole collective or none
+                        first = flows[f];
+                        break;
+                    }
+                }
+                for(auto other : collectives[c]->flows) {
+                    if(other->bottleneck == nullptr) other->bottleneck = first->bottleneck;
+                }
+                for(auto f : members[c]) {
+                    rate[f] = level;
+                    frozenFlow[f] = 1;
+                    activeFlows--;
+                }
+            }
+            int kept = 0;
+            for(auto l : activeLinks) {
+                if(!frozenLink[l]) activeLinks[kept++] = l;
+            }
+            activeLinks.resize(kept);
+        }
+        if(activeFlows == 0 || activeLinks.empty()) break;
+        minAug = numeric_limits<double>::infinity();
+        for(auto aug : partial) {
+            if(aug < minAug) minAug = aug;
+        }
+        level += minAug;
+        filled = true;
+    }
+
+    for(int f = 0; f < F; ++f) {
+        flows[f]->throughput = rate[f];
+    }
+    // if active flows is not empty, it is internal, it completes immediately
+    for(int f = 0; f < F; ++f) {
+        if(!frozenFlow[f]) flows[f]->throughput = numeric_limits<double>::infinity();
+    }
+    for(int l = 0; l < L; ++l) {
+        links[l]->throughput = throughput[l];
+    }
+}
+
+
+// Collectives as allocation units with their traffic aggregated per link,
+// so the solvers below work on units x links instead of flows x paths.
+class UnitGraph {
+public:
+    vector<vector<Flow*>> flows;                // unit -> flows
+    vector<GroupType> type;
+    vector<Link*> links;
+    vector<vector<pair<int, double>>> linksOf;  // unit -> (link, traffic per unit of rate)
+    vector<vector<pair<int, double>>> unitsOf;  // link -> (unit, traffic per unit of rate)
+    vector<double> rate;
+    vector<Link*> bottleneck;                   // unit -> link that froze it
+
+    UnitGraph(vector<Flow*>& all);
+    void apply();   // write rates back to flows and links
+};
+
+UnitGraph::UnitGraph(vector<Flow*>& all){
+    unordered_map<Collective*, int> unitIndex;
+    unordered_map<Link*, int> linkIndex;
+    vector<vector<pair<int, double>>> entries;
+    for(auto flow : all) {
+        auto it = unitIndex.find(flow->collective);
+        int u;
+        if(it == unitIndex.end()) {
+            u = flows.size();
+            unitIndex[flow->collective] = u;
+            flows.push_back(vector<Flow*>());
+            type.push_back(flow->collective->group->type);
+            entries.push_back(vector<pair<int, double>>());
+        }
+        else u = it->second;
+        flows[u].push_back(flow);
+        for(auto share : flow->linkShares) {
+            auto lt = linkIndex.find(share.first);
+            int l;
+            if(lt == linkIndex.end()) {
+                l = links.size();
+                linkIndex[share.first] = l;
+                links.push_back(share.first);
+                share.first->flows.clear();
+                share.first->load = 0;
+            }
+            else l = lt->second;
+            share.first->flows.insert(flow);
+            share.first->load += share.second;
+            entries[u].push_back(make_pair(l, share.second));
+        }
+    }
+    linksOf.resize(flows.size());
+    unitsOf.resize(links.size());
+    for(int u = 0; u < flows.size(); ++u) {
+        sort(entries[u].begin(), entries[u].end());
+        for(auto entry : entries[u]) {
+            if(!linksOf[u].empty() && linksOf[u].back().first == entry.first) linksOf[u].back().second += entry.second;
+            else linksOf[u].push_back(entry);
+        }
+        for(auto entry : linksOf[u]) {
+            unitsOf[entry.first].push_back(make_pair(u, entry.second));
+        }
+    }
+    rate.assign(flows.size(), 0);
+    bottleneck.assign(flows.size(), nullptr);
+}
+
+void UnitGraph::apply(){
+    for(auto link : links) {
+        link->throughput = 0;
+    }
+    for(int u = 0; u < flows.size(); ++u) {
+        if(linksOf[u].empty()) rate[u] = numeric_limits<double>::infinity(); // internal
+        for(auto flow : flows[u]) {
+            flow->throughput = rate[u];
+            flow->bottleneck = bottleneck[u];
+        }
+        for(auto entry : linksOf[u]) {
+            links[entry.first]->throughput += rate[u] * entry.second;
+        }
+    }
+}
+
+// Progressive filling: the rates of the given units grow with their weights
+// until a link on them saturates, then they freeze. Links are kept in a
+// heap by the fill level at which they saturate, so each freeze only
+// touches the links of the frozen unit. residual: capacity left per link.
+static void progressiveFill(UnitGraph& g, const vector<int>& units, const vector<double>& weight, vector<double>& residual){
+    vector<char> state(g.flows.size(), 0);  // 1 active, 2 frozen
+    vector<double> activeWeight(g.links.size(), 0);
+    vector<int> activeCount(g.links.size(), 0);
+    vector<int> version(g.links.size(), 0);
+    for(auto u : units) {
+        state[u] = 1;
+        for(auto entry : g.linksOf[u]) {
+            activeWeight[entry.first] += weight[u] * entry.second;
+            activeCount[entry.first]++;
+        }
+    }
+    typedef tuple<double, int, int> Saturation;    // level, link, version
+    priority_queue<Saturation, vector<Saturation>, greater<Saturation>> heap;
+    for(int l = 0; l < g.links.size(); ++l) {
+        if(activeCount[l] > 0) heap.push(make_tuple(max(0.0, residual[l]) / activeWeight[l], l, 0));
+    }
+    double level = 0;
+    while(!heap.empty()) {
+        double saturation = get<0>(heap.top());
+        int l = get<1>(heap.top());
+        int v = get<2>(heap.top());
+        heap.pop();
+        if(v != version[l] || activeCount[l] == 0) continue;
+        level = max(level, saturation);
+        for(auto entry : g.unitsOf[l]) {
+            int u = entry.first;
+            if(state[u] != 1) continue;
+            state[u] = 2;
+            g.rate[u] = weight[u] * level;
+            g.bottleneck[u] = g.links[l];
+            for(auto other : g.linksOf[u]) {
+                int m = other.first;
+                residual[m] -= g.rate[u] * other.second;
+                activeWeight[m] -= weight[u] * other.second;
+                activeCount[m]--;
+                version[m]++;
+                if(activeCount[m] > 0 && activeWeight[m] > 0) {
+                    heap.push(make_tuple(max(level, max(0.0, residual[m]) / activeWeight[m]), m, version[m]));
+                }
+            }
+        }
+    }
+}
+
+void WeightedMaxMinAllocator::allocate(vector<Flow*>& flows){
+    UnitGraph g(flows);
+    vector<int> units;
+    vector<double> weight;
+    for(int u = 0; u < g.flows.size(); ++u) {
+        units.push_back(u);
+        weight.push_back(weights[g.type[u]]);
+    }
+    vector<double> residual;
+    for(auto link : g.links) {
+        residual.push_back(link->capacity);
+    }
+    progressiveFill(g, units, weight, residual);
+    g.apply();
+}
+
+void PriorityAllocator::allocate(vector<Flow*>& flows){
+    UnitGraph g(flows);
+    vector<double> weight(g.flows.size(), 1.0);
+    vector<double> residual;
+    for(auto link : g.links) {
+        residual.push_back(link->capacity);
+    }
+    vector<bool> done(g.flows.size(), false);
+    for(int c = 0; c <= order.size(); ++c) {    // unlisted types last
+        vector<int> units;
+        for(int u = 0; u < g.flows.size(); ++u) {
+            if(done[u]) continue;
+            if(c == order.size() || g.type[u] == order[c]) {
+                units.push_back(u);
+                done[u] = true;
+            }
+        }
+        progressiveFill(g, units, weight, residual);
+    }
+    g.apply();
+}
+
+// Maximize sum w_u log r_u subject to link capacities through the dual:
+// every link has a price, a unit takes rate w_u / (sum of prices on it).
+// Sweeps set each link's price exactly (Newton on its own load, the other
+// prices fixed), which converges far faster than gradient price updates.
+void ProportionalFairAllocator::allocate(vector<Flow*>& flows){
+    UnitGraph g(flows);
+    int U = g.flows.size(), L = g.links.size();
+    vector<double> price(L, 0), unitPrice(U, 0), weight(U);
+    for(int l = 0; l < L; ++l) {    // warm start from the previous round
+        auto it = lastPrice.find(g.links[l]);
+        if(it != lastPrice.end()) price[l] = it->second;
+    }
+    vector<bool> blocked(U, false);     // crosses a link without capacity
+    for(int u = 0; u < U; ++u) {
+        weight[u] = weights[g.type[u]];
+        for(auto entry : g.linksOf[u]) {
+            if(g.links[entry.first]->capacity <= 0) blocked[u] = true;
+        }
+    }
+    for(int sweep = 0; sweep < maxIterations; ++sweep) {
+        fill(unitPrice.begin(), unitPrice.end(), 0);  // recomputed to avoid drift
+        for(int l = 0; l < L; ++l) {
+            for(auto entry : g.unitsOf[l]) {
+                unitPrice[entry.first] += entry.second * price[l];
+            }
+        }
+        for(int l = 0; l < L; ++l) {
+            double capacity = g.links[l]->capacity;
+            if(capacity <= 0) continue;
+            // load(x) = sum w a / (others + a x) is decreasing and convex in x,
+            // so Newton from a point below the root converges from below
+            auto load = [&](double x, double& slope) {
+                double total = -capacity;
+                slope = 0;
+                for(auto entry : g.unitsOf[l]) {
+                    int u = entry.first;
+                    if(blocked[u]) continue;
+                    double others = unitPrice[u] - entry.second * price[l];
+                    if(others <= 1e-12 * unitPrice[u]) others = 0;
+                    double q = others + entry.second * x;
+                    if(q <= 0) return numeric_limits<double>::infinity();
+                    total += weight[u] * entry.second / q;
+                    slope -= weight[u] * entry.second * entry.second / (q * q);
+                }
+                return total;
+            };
+            double unpriced = 0;    // weight of units priced only by this link
+            for(auto entry : g.unitsOf[l]) {
+                int u = entry.first;
+                if(!blocked[u] && unitPrice[u] - entry.second * price[l] <= 1e-12 * unitPrice[u]) unpriced += weight[u];
+            }
+            double slope;
+            double x = unpriced / capacity;     // load(x) >= 0 here
+            if(price[l] > x && load(price[l], slope) > 0) x = price[l];  // warm start
+            for(int step = 0; step < 100; ++step) {
+                double f = load(x, slope);
+                if(f <= 0 || slope == 0) break;     // x = 0 and the link is idle, or at the root
+                double next = x - f / slope;
+                bool done = next - x <= 1e-12 * next;
+                x = next;
+                if(done) break;
+            }
+            for(auto entry : g.unitsOf[l]) {
+                unitPrice[entry.first] += entry.second * (x - price[l]);
+            }
+            price[l] = x;
+        }
+
+        // converged when no link is over capacity and idle links are unpriced
+        vector<double> used(L, 0);
+        for(int u = 0; u < U; ++u) {
+            g.rate[u] = blocked[u] || unitPrice[u] <= 0 ? 0 : weight[u] / unitPrice[u];
+            for(auto entry : g.linksOf[u]) {
+                used[entry.first] += g.rate[u] * entry.second;
+            }
+        }
+        double error = 0;
+        for(int l = 0; l < L; ++l) {
+            if(g.links[l]->capacity <= 0) continue;
+            double ratio = used[l] / g.links[l]->capacity;
+            error = max(error, price[l] > 0 ? fabs(ratio - 1) : ratio - 1);
+        }
+        if(error < tolerance) break;
+    }
+
+    lastPrice.clear();
+    for(int l = 0; l < L; ++l) {
+        if(price[l] > 0) lastPrice[g.links[l]] = price[l];
+    }
+
+    // scale back so no link is over capacity
+    vector<double> used(L, 0);
+    for(int u = 0; u < U; ++u) {
+        for(auto entry : g.linksOf[u]) {
+            used[entry.first] += g.rate[u] * entry.second;
+        }
+    }
+    for(int u = 0; u < U; ++u) {
+        double over = 1;
+        for(auto entry : g.linksOf[u]) {
+            if(g.links[entry.first]->capacity > 0) over = max(over, used[entry.first] / g.links[entry.first]->capacity);
+        }
+        g.rate[u] /= over;
+    }
+    g.apply();
+}
+
+
+static bool parseGroupType(const string& s, GroupType& type){
+    if(s == "TP") type = GroupType::TP;
+    else if(s == "PP") type = GroupType::PP;
+    else if(s == "DP") type = GroupType::DP;
+    else return false;
+    return true;
+}
+
+Allocator* makeAllocator(const string& spec){
+    istringstream ss(spec);
+    string name;
+    ss >> name;
+    double w[3] = {1, 1, 1};
+    if(name == "maxmin") {
+        return new MaxMinAllocator();
+    }
+    if(name == "weighted" || name == "propfair") {
+        bool given = (bool)(ss >> w[0] >> w[1] >> w[2]);
+        if(name == "weighted" && !given) return nullptr;
+        if(!given) w[0] = w[1] = w[2] = 1;
+        if(w[0] <= 0 || w[1] <= 0 || w[2] <= 0) return nullptr;
+        if(name == "weighted") return new WeightedMaxMinAllocator(w[0], w[1], w[2]);
+        return new ProportionalFairAllocator(w[0], w[1], w[2]);
+    }
+    if(name == "priority") {
+        vector<GroupType> order;
+        string token;
+        GroupType type;
+        while(ss >> token) {
+            if(!parseGroupType(token, type)) return nullptr;
+            order.push_back(type);
+        }
+        return order.empty() ? nullptr : new PriorityAllocator(order);
+    }
+    return nullptr;
+}
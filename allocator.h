@@ -0,0 +1,82 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include "common.h"
+#include "simulator.h"
+#include "topology.h"
+#include "parallel.h"
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// Bandwidth sharing among the active flows of a round. An allocator sets
+// flow->throughput for every flow and link->throughput for the links they
+// use. The flows of one collective form a coupled unit with a single rate.
+class Allocator {
+public:
+    virtual ~Allocator() {}
+    virtual void allocate(vector<Flow*>& flows) = 0;
+};
+
+// The original water filling: per-link equal shares, freezing a flow
+// freezes its whole collective.
+class MaxMinAllocator : public Allocator {
+public:
+    void allocate(vector<Flow*>& flows);
+};
+
+// MaxMinAllocator's water filling on index arrays. Each filling round is one
+// pass of the worker pool over the active links; flows are only visited
+// when one of their links freezes. Every value gets the same operations in
+// the same order as in MaxMinAllocator and the round minimum is exact, so
+// rates and bottlenecks are bit-for-bit the sequential ones for any thread
+// count. link->flows is not filled.
+class ParallelMaxMinAllocator : public Allocator {
+public:
+    WorkerPool* pool;   // not owned
+    ParallelMaxMinAllocator(WorkerPool* pool) : pool(pool) {}
+    void allocate(vector<Flow*>& flows);
+    // flows distinct, links all of theirs and maybe more, link->load set;
+    // a flow's bottleneck is its frozen link that comes first in links
+    void fill(vector<Flow*>& flows, vector<Link*>& links);
+};
+
+// Weighted max-min between collectives, weights by group type.
+class WeightedMaxMinAllocator : public Allocator {
+public:
+    double weights[3];  // TP, PP, DP
+    WeightedMaxMinAllocator(double tp, double pp, double dp) : weights{tp, pp, dp} {}
+    void allocate(vector<Flow*>& flows);
+};
+
+// Strict priority traffic classes by group type; max-min inside a class
+// on what the higher classes left.
+class PriorityAllocator : public Allocator {
+public:
+    vector<GroupType> order;    // highest priority first
+    PriorityAllocator(vector<GroupType> order) : order(order) {}
+    void allocate(vector<Flow*>& flows);
+};
+
+// Weighted proportional fairness, solved by coordinate descent on link
+// prices and scaled back to feasibility at the end. Prices carry over to
+// the next round, where few collectives have changed.
+class ProportionalFairAllocator : public Allocator {
+public:
+    double weights[3];  // TP, PP, DP
+    int maxIterations;  // price sweeps
+    double tolerance;   // relative link over/under-use at convergence
+    ProportionalFairAllocator(double tp, double pp, double dp) :
+        weights{tp, pp, dp}, maxIterations(200), tolerance(1e-3) {}
+    void allocate(vector<Flow*>& flows);
+
+    unordered_map<Link*, double> lastPrice;
+};
+
+// maxmin | weighted <TP> <PP> <DP> | priority <type> <type> <type> | propfair [<TP> <PP> <DP>]
+Allocator* makeAllocator(const string& spec);
+
+#endif // ALLOCATOR_H
@@ -0,0 +1,124 @@
+#include "analytical.h"
+#include "common.h"
+
+#include <iostream>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+
+// Alpha part plus the slowest flow at the rates allocated to `rates`, a
+// collective on the same connections.
+static double duration(Collective* collective, Collective* rates){
+    double time = 0;
+    for(int i = 0; i < collective->flows.size(); ++i) {
+        double size = collective->flows[i]->remainingSize;
+        double throughput = rates->flows[i]->throughput;
+        if(size <= 0 || throughput == numeric_limits<double>::infinity()) continue;
+        time = max(time, size / throughput);
+    }
+    return collective->remainingLatency + time;
+}
+
+double AnalyticalEstimator::estimate(){
+    if(workload->trace != nullptr) return -1;
+    int PP = workload->PP;
+    fwdTP.assign(PP, 0);
+    bwdTP.assign(PP, 0);
+    fwdPP.assign(PP, 0);
+    bwdPP.assign(PP, 0);
+    allReduce.assign(PP, 0);
+    work.assign(PP, 0);
+
+    // one collective per group; building them must not count as aggregation use
+    Topology* topology = workload->topology;
+    int aggregated = topology->aggregatedCollectives, fallbacks = topology->aggregationFallbacks;
+    vector<vector<Collective*>> steady(PP);   // TP by stage
+    vector<Collective*> backward, transfers, reduce;
+    for(auto group : workload->groups) {
+        if(group->type == GroupType::TP) {
+            steady[group->pp].push_back(new Collective(group, 1, 1));
+            backward.push_back(new Collective(group, -1, 1));
+        }
+        else if(group->type == GroupType::PP) {
+            if(group->ranks[0] == group->ranks[1]) continue;    // activation offload
+            transfers.push_back(new Collective(group, group->ranks[0]->ppFwdGroup == group ? 1 : -1, 1));
+        }
+        else {
+            reduce.push_back(new Collective(group, 0, 1));
+        }
+    }
+
+    static MaxMinAllocator maxMin;
+    Allocator* sharing = allocator != nullptr ? allocator : &maxMin;
+    vector<vector<Collective*>*> phases = {&transfers, &reduce};
+    for(auto& stage : steady) {
+        phases.push_back(&stage);
+    }
+    for(auto phase : phases) {
+        vector<Flow*> flows;
+        for(auto collective : *phase) {
+            for(auto flow : collective->flows) {
+                flows.push_back(flow);
+            }
+        }
+        sharing->allocate(flows);
+    }
+
+    int tp = 0;
+    for(auto& stage : steady) {
+        for(auto collective : stage) {
+            Group* group = collective->group;
+            fwdTP[group->pp] = max(fwdTP[group->pp], duration(collective, collective));
+            bwdTP[group->pp] = max(bwdTP[group->pp], duration(backward[tp++], collective));
+        }
+    }
+    for(auto collective : transfers) {
+        Group* group = collective->group;
+        double time = duration(collective, collective);
+        if(collective->microbatch > 0) fwdPP[group->pp] = max(fwdPP[group->pp], time);
+        else bwdPP[group->pp] = max(bwdPP[group->pp], time);
+    }
+    for(auto collective : reduce) {
+        allReduce[collective->group->pp] = max(allReduce[collective->group->pp], duration(collective, collective));
+    }
+    phases.push_back(&backward);
+    for(auto phase : phases) {
+        for(auto collective : *phase) {
+            delete collective;
+        }
+    }
+    topology->aggregatedCollectives = aggregated;
+    topology->aggregationFallbacks = fallbacks;
+
+    // busiest stage between the pipeline fill and drain
+    iteration = 0;
+    bottleneck = 0;
+    double fill = 0, drain = 0;
+    for(int s = 0; s < PP; ++s) {
+        for(int mb = 1; mb <= workload->microbatches; ++mb) {
+            work[s] += workload->getCompTime(s, mb) + workload->getCompTime(s, -mb) + fwdTP[s] + bwdTP[s];
+        }
+        if(s > 0) drain += bwdPP[s];
+        double end = fill + work[s] + max(allReduce[s], drain + allReduce[0]);
+        if(end > iteration) {
+            iteration = end;
+            bottleneck = s;
+        }
+        fill += workload->getCompTime(s, 1) + fwdTP[s] + fwdPP[s];
+        drain += workload->getCompTime(s, -1) + bwdTP[s];
+    }
+    time = iteration * workload->iterations + workload->arrivalTime;
+    return time;
+}
+
+void AnalyticalEstimator::print(double simulated){
+    cout << "Analytical estimate: " << time << " s (" << workload->iterations << " x " << iteration
+         << " s, bottleneck stage " << bottleneck << ": " << work[bottleneck] << " s compute and TP, DP "
+         << allReduce[bottleneck] << " s)" << endl;
+    if(simulated > 0) {
+        cout << "Simulated: " << simulated << " s, estimate error " << 100 * (time - simulated) / simulated << "%" << endl;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef ANALYTICAL_H
+#define ANALYTICAL_H
+
+#include "workload.h"
+#include "simulator.h"
+#include "allocator.h"
+
+#include <vector>
+
+using namespace std;
+
+// Closed-form 1F1B iteration time of a routed workload, without running
+// the simulator. Collective times come from one static max-min allocation
+// per traffic phase on the routed connections: the TP collectives of one
+// stage, the PP transfers of all stages, all DP all-reduces at the end.
+// The pipeline is then the first forward reaching the busiest stage, its
+// microbatches back to back, the last backward draining to stage 0 and the
+// DP all-reduces. Overlapping phases and transfers inside the steady
+// state make it drift from the simulation, by some percent on small jobs.
+class AnalyticalEstimator {
+public:
+    Workload* workload;
+    Allocator* allocator;   // bandwidth sharing, max-min when null; not owned
+
+    AnalyticalEstimator(Workload* workload, Allocator* allocator = nullptr) : workload(workload), allocator(allocator) {}
+
+    // per stage, one collective of the stage including its alpha part; PP by sending stage
+    vector<double> fwdTP, bwdTP, fwdPP, bwdPP, allReduce;
+    vector<double> work;    // compute and TP of all microbatches
+    int bottleneck;         // stage that sets the iteration time
+    double iteration;       // one iteration
+    double time;            // all iterations of the workload
+
+    double estimate();      // -1 for trace workloads
+    void print(double simulated = -1);  // with the relative error against a simulated time
+};
+
+#endif // ANALYTICAL_H
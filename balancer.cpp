@@ -0,0 +1,203 @@
+#include "balancer.h"
+#include "common.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+
+// Layer records share the profile file with Workload::loadProfile:
+//   layer <fwdComp> <bwdComp> <fwdTP> <bwdTP> <activation> <params>
+bool StageBalancer::loadLayers(const string& path){
+    ifstream in(path);
+    if(!in.is_open()) {
+        cerr << "Cannot open profile " << path << endl;
+        return false;
+    }
+    string line;
+    int lineNo = 0;
+    while(getline(in, line)) {
+        lineNo++;
+        line = line.substr(0, line.find('#'));
+        istringstream ss(line);
+        string kind;
+        if(!(ss >> kind) || kind != "layer") continue;
+        LayerCost layer;
+        if(!(ss >> layer.fwdCompTime >> layer.bwdCompTime >> layer.fwdTPSize >> layer.bwdTPSize
+                >> layer.activationSize >> layer.paramSize)) {
+            cerr << "Invalid layer record at " << path << ":" << lineNo << endl;
+            return false;
+        }
+        layers.push_back(layer);
+    }
+    if(layers.size() < PP) {
+        cerr << "Profile has " << layers.size() << " layers, fewer than " << PP << " stages" << endl;
+        return false;
+    }
+    return true;
+}
+
+void StageBalancer::applyPartition(Workload* workload, const vector<int>& partition){
+    int begin = 0;
+    for(int s = 0; s < PP; ++s) {
+        int end = begin + partition[s];
+        double fwdComp = 0, bwdComp = 0, fwdTP = 0, bwdTP = 0, dp = 0;
+        for(int l = begin; l < end; ++l) {
+            fwdComp += layers[l].fwdCompTime;
+            bwdComp += layers[l].bwdCompTime;
+            fwdTP += layers[l].fwdTPSize;
+            bwdTP += layers[l].bwdTPSize;
+            dp += layers[l].paramSize;
+        }
+        workload->stageFwdCompTime[s] = fwdComp;
+        workload->stageBwdCompTime[s] = bwdComp;
+        workload->stageFwdTPSize[s] = fwdTP;
+        workload->stageBwdTPSize[s] = bwdTP;
+        workload->stageFwdPPSize[s] = layers[end - 1].activationSize;             // to stage s+1
+        workload->stageBwdPPSize[s] = begin > 0 ? layers[begin - 1].activationSize : 0; // to stage s-1
+        workload->stageDPSize[s] = dp;
+        begin = end;
+    }
+}
+
+double StageBalancer::evaluate(const vector<int>& partition){
+    auto it = evaluated.find(partition);
+    if(it != evaluated.end()) {
+        return it->second;
+    }
+
+    srand(0);   // same routing for every candidate
+    Workload* workload = new Workload(PP, DP, TP, microbatches, 0, 0, 0, 0, 0, 0, 0);
+    applyPartition(workload, partition);
+    workload->topology = topology;
+    workload->configureParallelism();
+    workload->placement();
+    workload->routing();
+
+    Simulator* simulator = new Simulator();
+    simulator->workloads.push_back(workload);
+    simulator->topology = topology;
+    simulator->verbose = false;
+    simulator->initialize();
+    simulator->run();
+    double time = simulator->globalTime;
+
+    delete simulator;
+    delete workload;
+    evaluated[partition] = time;
+    return time;
+}
+
+vector<int> StageBalancer::initialPartition(){  // minimize the maximum per-stage compute time
+    int L = layers.size();
+    vector<double> prefix(L + 1, 0);
+    for(int l = 0; l < L; ++l) {
+        prefix[l + 1] = prefix[l] + layers[l].fwdCompTime + layers[l].bwdCompTime;
+    }
+    double inf = numeric_limits<double>::infinity();
+    // cost[s][i]: best bottleneck for the first i layers on s+1 stages
+    vector<vector<double>> cost(PP, vector<double>(L + 1, inf));
+    vector<vector<int>> cut(PP, vector<int>(L + 1, 0));
+    for(int i = 1; i <= L; ++i) {
+        cost[0][i] = prefix[i];
+    }
+    for(int s = 1; s < PP; ++s) {
+        for(int i = s + 1; i <= L; ++i) {
+            for(int j = s; j < i; ++j) {
+                double c = max(cost[s - 1][j], prefix[i] - prefix[j]);
+                if(c < cost[s][i]) {
+                    cost[s][i] = c;
+                    cut[s][i] = j;
+                }
+            }
+        }
+    }
+    vector<int> partition(PP);
+    int i = L;
+    for(int s = PP - 1; s > 0; --s) {
+        partition[s] = i - cut[s][i];
+        i = cut[s][i];
+    }
+    partition[0] = i;
+    return partition;
+}
+
+static void enumeratePartitions(int stage, int stages, int remaining, vector<int>& current, vector<vector<int>>& out){
+    if(stage == stages - 1) {
+        current[stage] = remaining;
+        out.push_back(current);
+        return;
+    }
+    for(int n = 1; n <= remaining - (stages - stage - 1); ++n) {
+        current[stage] = n;
+        enumeratePartitions(stage + 1, stages, remaining - n, current, out);
+    }
+}
+
+vector<int> StageBalancer::balance(){
+    int L = layers.size();
+
+    // number of partitions: C(L-1, PP-1)
+    double count = 1;
+    for(int k = 1; k < PP; ++k) {
+        count = count * (L - k) / k;
+    }
+
+    vector<int> best;
+    double bestTime = numeric_limits<double>::infinity();
+    if(count <= maxEvaluations) {
+        vector<vector<int>> candidates;
+        vector<int> current(PP);
+        enumeratePartitions(0, PP, L, current, candidates);
+        for(auto& partition : candidates) {
+            double time = evaluate(partition);
+            if(time < bestTime) {
+                bestTime = time;
+                best = partition;
+            }
+        }
+        return best;
+    }
+
+    // hill climbing from the compute-balanced partition, moving one layer across a stage boundary
+    best = initialPartition();
+    bestTime = evaluate(best);
+    while(evaluated.size() < maxEvaluations) {
+        vector<int> bestNeighbor;
+        double bestNeighborTime = bestTime;
+        for(int b = 0; b < PP - 1; ++b) {
+            for(int dir = 0; dir < 2; ++dir) {
+                vector<int> neighbor = best;
+                int from = dir == 0 ? b : b + 1;
+                int to = dir == 0 ? b + 1 : b;
+                if(neighbor[from] <= 1) continue;
+                neighbor[from]--;
+                neighbor[to]++;
+                double time = evaluate(neighbor);
+                if(time < bestNeighborTime) {
+                    bestNeighborTime = time;
+                    bestNeighbor = neighbor;
+                }
+            }
+        }
+        if(bestNeighbor.empty()) break;
+        best = bestNeighbor;
+        bestTime = bestNeighborTime;
+    }
+    return best;
+}
+
+void StageBalancer::print(const vector<int>& partition){
+    cout << "Stage partition (" << evaluated.size() << " candidates simulated):" << endl;
+    int begin = 0;
+    for(int s = 0; s < PP; ++s) {
+        cout << "  Stage " << s << ": layers [" << begin << ", " << begin + partition[s] << ")" << endl;
+        begin += partition[s];
+    }
+    cout << "Iteration time: " << evaluate(partition) << endl;
+}
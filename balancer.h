@@ -0,0 +1,45 @@
+#ifndef BALANCER_H
+#define BALANCER_H
+
+#include "topology.h"
+#include "workload.h"
+#include "simulator.h"
+
+#include <vector>
+#include <map>
+#include <string>
+
+using namespace std;
+
+class LayerCost {
+public:
+    double fwdCompTime, bwdCompTime;
+    double fwdTPSize, bwdTPSize;
+    double activationSize;  // output activation, its gradient flows backward
+    double paramSize;       // gradient size reduced by DP
+};
+
+// Search layer-to-stage partitions with the simulator as the cost model.
+// A partition is the number of layers assigned to each PP stage.
+class StageBalancer {
+public:
+    Topology* topology;
+    int PP, DP, TP, microbatches;
+    vector<LayerCost> layers;
+    int maxEvaluations;  // exhaustive search below this many partitions, hill climbing above
+
+    StageBalancer(Topology* topology, int PP, int DP, int TP, int microbatches) :
+        topology(topology), PP(PP), DP(DP), TP(TP), microbatches(microbatches), maxEvaluations(2000) {}
+
+    bool loadLayers(const string& path);
+    void applyPartition(Workload* workload, const vector<int>& partition);
+    double evaluate(const vector<int>& partition);
+    vector<int> initialPartition();
+    vector<int> balance();
+
+    map<vector<int>, double> evaluated;  // memoized iteration times
+
+    void print(const vector<int>& partition);
+};
+
+#endif // BALANCER_H
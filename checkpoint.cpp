@@ -0,0 +1,474 @@
+#include "checkpoint.h"
+#include "common.h"
+#include "congestion.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <map>
+
+using namespace std;
+
+
+static const char* magic = "SIMCKPT2";
+
+template<class T> static void put(string& state, T value){
+    state.append((const char*)&value, sizeof(T));
+}
+
+// Reads what capture() wrote; a short or mismatched state clears ok.
+class StateReader {
+public:
+    const string& state;
+    size_t at = 0;
+    bool ok = true;
+    StateReader(const string& state) : state(state) {}
+
+    template<class T> T take(){
+        T value = T();
+        if(at + sizeof(T) > state.size()) {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, state.data() + at, sizeof(T));
+        at += sizeof(T);
+        return value;
+    }
+    int count(){    // element count, at least one byte each
+        int n = take<int32_t>();
+        if(n < 0 || at + n > state.size()) ok = false;
+        return ok ? n : 0;
+    }
+};
+
+// Topology link id, or for a PCIe pseudo-link -1 - its key.
+static int linkKey(Topology* topology, Link* link){
+    if(link->id >= 0) return link->id;
+    for(auto it : topology->pcieLinks) {
+        if(it.second == link) return -1 - it.first;
+    }
+    return numeric_limits<int>::min();
+}
+
+static Link* linkAt(Topology* topology, int key){
+    if(key >= 0) return key < topology->links.size() ? topology->links[key] : nullptr;
+    auto it = topology->pcieLinks.find(-1 - key);
+    return it != topology->pcieLinks.end() ? it->second : nullptr;
+}
+
+static void putCollective(string& state, Collective* collective){
+    put<int32_t>(state, collective->microbatch);
+    put<int32_t>(state, collective->accumulatedInvocations);
+    put<int32_t>(state, collective->accumulatedSize);
+    put<double>(state, collective->remainingLatency);
+    put<char>(state, collective->aggregated);
+    put<int32_t>(state, collective->flows.size());
+    for(auto flow : collective->flows) {
+        put<double>(state, flow->remainingSize);
+        put<double>(state, flow->throughput);
+        put<char>(state, flow->controlled);
+        put<double>(state, flow->rate);
+        put<double>(state, flow->targetRate);
+        put<double>(state, flow->alpha);
+    }
+}
+
+// The constructor picks a reduction tree or the ring from the trees in
+// use; the snapshot's choice is forced and the counters are set afterwards.
+static Collective* takeCollective(StateReader& in, Group* group){
+    int microbatch = in.take<int32_t>();
+    int invocations = in.take<int32_t>();
+    int size = in.take<int32_t>();
+    double latency = in.take<double>();
+    bool aggregated = in.take<char>();
+    Topology* topology = group->workload->topology;
+    int maxTrees = topology->maxAggregationTrees;
+    if(aggregated) topology->maxAggregationTrees = 0;
+    else {
+        topology->maxAggregationTrees = 1;
+        topology->activeAggregationTrees = 1;
+    }
+    Collective* collective = new Collective(group, microbatch, size);
+    topology->maxAggregationTrees = maxTrees;
+    collective->accumulatedInvocations = invocations;
+    collective->remainingLatency = latency;
+    int flows = in.count();
+    if(flows != collective->flows.size()) in.ok = false;
+    for(int i = 0; i < flows && in.ok; ++i) {
+        Flow* flow = collective->flows[i];
+        flow->remainingSize = in.take<double>();
+        flow->throughput = in.take<double>();
+        flow->controlled = in.take<char>();
+        flow->rate = in.take<double>();
+        flow->targetRate = in.take<double>();
+        flow->alpha = in.take<double>();
+    }
+    return collective;
+}
+
+static bool routable(Connection* connection){
+    for(auto share : connection->linkShares) {
+        if(share.first->id < 0) return false;
+    }
+    return true;
+}
+
+bool Checkpoint::capture(Simulator* simulator){
+    if(simulator->packets != nullptr || simulator->partition != nullptr) {
+        cerr << "Cannot checkpoint packet-level links or a distributed run" << endl;
+        return false;
+    }
+    for(auto workload : simulator->workloads) {
+        if(workload->trace != nullptr) {
+            cerr << "Cannot checkpoint a trace replay" << endl;
+            return false;
+        }
+    }
+    time = simulator->globalTime;
+    state.clear();
+    put<double>(state, simulator->globalTime);
+    put<int32_t>(state, simulator->nextFault);
+    put<int32_t>(state, simulator->reroutedConnections);
+    put<int32_t>(state, simulator->migratedFlows);
+
+    // jobs, in the order their tasks were created
+    vector<int> admission;
+    Workload* last = nullptr;
+    for(auto task : simulator->tasks) {
+        GroupTask* groupTask = dynamic_cast<GroupTask*>(task);
+        Workload* workload = groupTask != nullptr ? groupTask->group->workload : ((RankTask*)task)->rank->workload;
+        if(workload == last) continue;
+        last = workload;
+        for(int i = 0; i < simulator->workloads.size(); ++i) {
+            if(simulator->workloads[i] == workload) admission.push_back(i);
+        }
+    }
+    put<int32_t>(state, simulator->workloads.size());
+    put<int32_t>(state, admission.size());
+    for(auto i : admission) put<int32_t>(state, i);
+    for(auto workload : simulator->workloads) {
+        put<int32_t>(state, workload->finishedRanks.size());
+        for(auto ranks : workload->finishedRanks) put<int32_t>(state, ranks);
+        put<int32_t>(state, workload->iterationEnds.size());
+        for(auto end : workload->iterationEnds) put<double>(state, end);
+    }
+
+    // links and routes, as faults left them
+    Topology* topology = simulator->topology;
+    put<int32_t>(state, topology->links.size());
+    for(auto link : topology->links) {
+        put<double>(state, link->capacity);
+        put<char>(state, link->failed);
+    }
+    put<int32_t>(state, topology->activeAggregationTrees);
+    put<int32_t>(state, topology->aggregatedCollectives);
+    put<int32_t>(state, topology->aggregationFallbacks);
+    for(auto workload : simulator->workloads) {
+        for(auto group : workload->groups) {
+            for(auto connection : group->connections) {
+                put<char>(state, routable(connection));    // PCIe copies are never rerouted
+                if(!routable(connection)) continue;
+                put<int32_t>(state, connection->path.size());
+                for(auto node : connection->path) put<int32_t>(state, node->id);
+                put<int32_t>(state, connection->pathLinks.size());
+                for(auto link : connection->pathLinks) put<int32_t>(state, link->id);
+                put<int32_t>(state, connection->linkShares.size());
+                for(auto share : connection->linkShares) {
+                    put<int32_t>(state, share.first->id);
+                    put<double>(state, share.second);
+                }
+            }
+        }
+    }
+
+    CongestionControl* congestion = simulator->congestion;
+    put<char>(state, congestion != nullptr);
+    if(congestion != nullptr) {
+        put<char>(state, congestion->stable);
+        put<double>(state, congestion->step);
+        put<int32_t>(state, congestion->settledSteps);
+        put<double>(state, congestion->transientTime);
+        put<int32_t>(state, congestion->flows.size());
+        vector<pair<int, double>> queued;
+        for(auto it : congestion->queue) {
+            int key = linkKey(topology, it.first);
+            if(it.second > 0 && key != numeric_limits<int>::min()) queued.push_back(make_pair(key, it.second));
+        }
+        put<int32_t>(state, queued.size());
+        for(auto it : queued) {
+            put<int32_t>(state, it.first);
+            put<double>(state, it.second);
+        }
+    }
+
+    put<int32_t>(state, simulator->tasks.size());
+    for(auto task : simulator->tasks) {
+        GroupTask* groupTask = dynamic_cast<GroupTask*>(task);
+        if(groupTask != nullptr) {
+            put<char>(state, 'G');
+            put<int32_t>(state, groupTask->events.size());
+            for(auto event : groupTask->events) {
+                put<int32_t>(state, get<0>(event));
+                put<int32_t>(state, get<1>(event));
+            }
+            put<int32_t>(state, groupTask->invocationSizes.size());
+            for(auto it : groupTask->invocationSizes) {
+                put<int32_t>(state, it.first);
+                put<double>(state, it.second);
+            }
+            put<int32_t>(state, groupTask->accumulatingCollectives.size());
+            for(auto it : groupTask->accumulatingCollectives) putCollective(state, it.second);
+            put<int32_t>(state, groupTask->waitingCollectives.size());
+            for(auto collective : groupTask->waitingCollectives) putCollective(state, collective);
+            put<char>(state, groupTask->activeCollective != nullptr);
+            if(groupTask->activeCollective != nullptr) putCollective(state, groupTask->activeCollective);
+            continue;
+        }
+        RankTask* rankTask = (RankTask*)task;
+        put<char>(state, 'R');
+        put<int32_t>(state, rankTask->state);
+        put<int32_t>(state, rankTask->microbatch);
+        put<int32_t>(state, rankTask->iteration);
+        put<double>(state, rankTask->remainingTime);
+        put<int32_t>(state, rankTask->events.size());
+        for(auto event : rankTask->events) {
+            put<int32_t>(state, get<0>(event));
+            put<int32_t>(state, get<1>(event));
+            put<int32_t>(state, get<2>(event));
+        }
+        put<double>(state, rankTask->clock);
+        put<double>(state, rankTask->activationMemory);
+        put<double>(state, rankTask->peakMemory);
+        put<int32_t>(state, rankTask->memoryTimeline.size());
+        for(auto point : rankTask->memoryTimeline) {
+            put<double>(state, point.first);
+            put<double>(state, point.second);
+        }
+        for(auto microbatches : {&rankTask->offloading, &rankTask->offloaded, &rankTask->reloading}) {
+            put<int32_t>(state, microbatches->size());
+            for(auto mb : *microbatches) put<int32_t>(state, mb);
+        }
+    }
+    return true;
+}
+
+bool Checkpoint::restore(Simulator* simulator){
+    StateReader in(state);
+    double globalTime = in.take<double>();
+    int nextFault = in.take<int32_t>();
+    int rerouted = in.take<int32_t>();
+    int migrated = in.take<int32_t>();
+    int workloads = in.take<int32_t>();
+    if(!in.ok || workloads != simulator->workloads.size() || !simulator->tasks.empty()) {
+        cerr << "Checkpoint does not match the simulator's jobs" << endl;
+        return false;
+    }
+    vector<int> admission(in.count());
+    for(auto& i : admission) {
+        i = in.take<int32_t>();
+        if(i < 0 || i >= workloads) in.ok = false;
+    }
+    vector<vector<int>> finishedRanks(workloads);
+    vector<vector<double>> iterationEnds(workloads);
+    for(int w = 0; w < workloads; ++w) {
+        finishedRanks[w].resize(in.count());
+        for(auto& ranks : finishedRanks[w]) ranks = in.take<int32_t>();
+        iterationEnds[w].resize(in.count());
+        for(auto& end : iterationEnds[w]) end = in.take<double>();
+    }
+
+    Topology* topology = simulator->topology;
+    if(in.take<int32_t>() != topology->links.size() || !in.ok) {
+        cerr << "Checkpoint does not match the topology" << endl;
+        return false;
+    }
+    bool failures = false;
+    for(auto link : topology->links) {
+        link->capacity = in.take<double>();
+        link->failed = in.take<char>();
+        failures |= link->failed;
+    }
+    if(failures) topology->routingReady = false;
+    int activeTrees = in.take<int32_t>();
+    int aggregated = in.take<int32_t>();
+    int fallbacks = in.take<int32_t>();
+    for(auto workload : simulator->workloads) {
+        for(auto group : workload->groups) {
+            for(auto connection : group->connections) {
+                if(!in.take<char>() || !in.ok) continue;
+                connection->path.resize(in.count());
+                for(auto& node : connection->path) {
+                    int id = in.take<int32_t>();
+                    if(id < 0 || id >= topology->nodes.size()) in.ok = false;
+                    node = in.ok ? topology->nodes[id] : nullptr;
+                }
+                connection->pathLinks.resize(in.count());
+                for(auto& link : connection->pathLinks) {
+                    int id = in.take<int32_t>();
+                    if(id < 0 || id >= topology->links.size()) in.ok = false;
+                    link = in.ok ? topology->links[id] : nullptr;
+                }
+                connection->linkShares.resize(in.count());
+                for(auto& share : connection->linkShares) {
+                    int id = in.take<int32_t>();
+                    if(id < 0 || id >= topology->links.size()) in.ok = false;
+                    share.first = in.ok ? topology->links[id] : nullptr;
+                    share.second = in.take<double>();
+                }
+            }
+        }
+    }
+    if(in.take<char>()) {
+        bool stable = in.take<char>();
+        double step = in.take<double>();
+        int settled = in.take<int32_t>();
+        double transient = in.take<double>();
+        int flows = in.take<int32_t>();
+        map<Link*, double> queue;
+        int queued = in.count();
+        for(int i = 0; i < queued && in.ok; ++i) {
+            Link* link = linkAt(topology, in.take<int32_t>());
+            if(link == nullptr) in.ok = false;
+            queue[link] = in.take<double>();
+        }
+        CongestionControl* congestion = simulator->congestion;
+        if(congestion != nullptr) {
+            congestion->stable = stable;
+            congestion->step = step;
+            congestion->settledSteps = settled;
+            congestion->transientTime = transient;
+            // only their number is looked at before the next allocation
+            congestion->flows.assign(max(0, flows), nullptr);
+            congestion->links.clear();
+            congestion->queue = queue;
+        }
+    }
+    if(!in.ok) {
+        cerr << "Corrupt checkpoint" << endl;
+        return false;
+    }
+
+    // tasks as initialize() and later admissions made them, then their state
+    simulator->admitted.assign(workloads, false);
+    for(auto i : admission) {
+        simulator->initializeWorkload(simulator->workloads[i]);
+        simulator->admitted[i] = true;
+    }
+    simulator->start();
+    simulator->globalTime = globalTime;
+    simulator->nextFault = nextFault;
+    simulator->reroutedConnections = rerouted;
+    simulator->migratedFlows = migrated;
+    for(int w = 0; w < workloads; ++w) {
+        simulator->workloads[w]->finishedRanks = finishedRanks[w];
+        simulator->workloads[w]->iterationEnds = iterationEnds[w];
+    }
+    if(in.count() != simulator->tasks.size()) in.ok = false;
+    for(int t = 0; t < simulator->tasks.size() && in.ok; ++t) {
+        Task* task = simulator->tasks[t];
+        GroupTask* groupTask = dynamic_cast<GroupTask*>(task);
+        char kind = in.take<char>();
+        if(kind != (groupTask != nullptr ? 'G' : 'R')) {
+            in.ok = false;
+            break;
+        }
+        if(groupTask != nullptr) {
+            Group* group = groupTask->group;
+            groupTask->events.resize(in.count());
+            for(auto& event : groupTask->events) {
+                int from = in.take<int32_t>();
+                event = make_tuple(from, (int)in.take<int32_t>());
+            }
+            int sizes = in.count();
+            for(int i = 0; i < sizes; ++i) {
+                int mb = in.take<int32_t>();
+                groupTask->invocationSizes[mb] = in.take<double>();
+            }
+            int accumulating = in.count();
+            for(int i = 0; i < accumulating && in.ok; ++i) {
+                Collective* collective = takeCollective(in, group);
+                groupTask->accumulatingCollectives[collective->microbatch] = collective;
+            }
+            int waiting = in.count();
+            for(int i = 0; i < waiting && in.ok; ++i) {
+                groupTask->waitingCollectives.push_back(takeCollective(in, group));
+            }
+            if(in.take<char>() && in.ok) groupTask->activeCollective = takeCollective(in, group);
+            continue;
+        }
+        RankTask* rankTask = (RankTask*)task;
+        rankTask->state = (RankState)in.take<int32_t>();
+        rankTask->microbatch = in.take<int32_t>();
+        rankTask->iteration = in.take<int32_t>();
+        rankTask->remainingTime = in.take<double>();
+        rankTask->events.resize(in.count());
+        for(auto& event : rankTask->events) {
+            int endpoint = in.take<int32_t>();
+            int type = in.take<int32_t>();
+            event = make_tuple(endpoint, type, (int)in.take<int32_t>());
+        }
+        rankTask->clock = in.take<double>();
+        rankTask->activationMemory = in.take<double>();
+        rankTask->peakMemory = in.take<double>();
+        rankTask->memoryTimeline.resize(in.count());
+        for(auto& point : rankTask->memoryTimeline) {
+            double at = in.take<double>();
+            point = make_pair(at, in.take<double>());
+        }
+        for(auto microbatches : {&rankTask->offloading, &rankTask->offloaded, &rankTask->reloading}) {
+            microbatches->clear();
+            int n = in.count();
+            for(int i = 0; i < n; ++i) microbatches->insert(in.take<int32_t>());
+        }
+    }
+    topology->activeAggregationTrees = activeTrees;
+    topology->aggregatedCollectives = aggregated;
+    topology->aggregationFallbacks = fallbacks;
+    if(!in.ok || in.at != state.size()) {
+        cerr << "Checkpoint does not match the simulator's tasks" << endl;
+        return false;
+    }
+    return true;
+}
+
+Simulator* Checkpoint::fork(Simulator* simulator){
+    Simulator* branch = new Simulator();
+    branch->workloads = simulator->workloads;
+    branch->topology = simulator->topology;
+    branch->verbose = simulator->verbose;
+    branch->allocator = simulator->allocator;
+    if(simulator->congestion != nullptr) branch->congestion = new CongestionControl(*simulator->congestion);
+    branch->threads = simulator->threads;
+    branch->faults = simulator->faults;
+    if(!restore(branch)) {
+        delete branch;
+        return nullptr;
+    }
+    return branch;
+}
+
+bool Checkpoint::save(const string& path){
+    ofstream out(path, ios::binary);
+    out.write(magic, strlen(magic));
+    out.write(state.data(), state.size());
+    if(!out) {
+        cerr << "Cannot write checkpoint " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+bool Checkpoint::load(const string& path){
+    ifstream in(path, ios::binary);
+    string start(strlen(magic), '\0');
+    if(!in.is_open() || !in.read(&start[0], start.size()) || start != magic) {
+        cerr << "Cannot read checkpoint " << path << endl;
+        return false;
+    }
+    state.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    StateReader header(state);
+    time = header.take<double>();
+    return true;
+}
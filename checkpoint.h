@@ -0,0 +1,37 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "simulator.h"
+#include "topology.h"
+#include "workload.h"
+
+#include <string>
+
+using namespace std;
+
+// Dynamic state of a simulator between two rounds: tasks with their events,
+// accumulating, waiting and active collectives, flow progress and
+// congestion state with its link queues, link capacities, connection
+// routes, job admission and iteration records. Topology and workloads are not copied,
+// a restored simulator runs on the same objects, so branches of one
+// snapshot run one after another. The critical path and utilization
+// recorders start over at the snapshot.
+class Checkpoint {
+public:
+    double time = 0;    // simulated time of the snapshot
+    string state;       // serialized
+
+    bool capture(Simulator* simulator); // false for trace replay, packet-level links and distributed runs
+    // into a simulator with the snapshot's topology and workloads and no
+    // tasks yet, in place of initialize() and start()
+    bool restore(Simulator* simulator);
+    // a new simulator with simulator's topology, workloads, allocator,
+    // threads and faults and a copy of its congestion control (the caller
+    // deletes it with the branch), restored
+    Simulator* fork(Simulator* simulator);
+
+    bool save(const string& path);
+    bool load(const string& path);
+};
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,130 @@
+#include "cluster.h"
+#include "common.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+
+// One job per line, '#' starts a comment:
+//   job <name> <PP> <DP> <TP> <microbatches> <fwdComp> <bwdComp> <fwdTP> <bwdTP> <fwdPP> <bwdPP> <dp>
+//       <firstHost> <numHosts> <arrival> <iterations>
+//   allocator <spec>      (see makeAllocator)
+// Hosts are indexed in id order; the job owns hosts [firstHost, firstHost + numHosts),
+// at least one per rank and none of another job's.
+bool ClusterScenario::load(const string& path){
+    ifstream in(path);
+    if(!in.is_open()) {
+        cerr << "Cannot open job file " << path << endl;
+        return false;
+    }
+    vector<Node*> hosts;
+    for(auto node : topology->nodes) {
+        if(node->type == NodeType::HOST) {
+            hosts.push_back(node);
+        }
+    }
+    sort(hosts.begin(), hosts.end(), [](Node* a, Node* b) {
+        return a->id < b->id;
+    });
+
+    vector<int> owner(hosts.size(), 0);     // line of the job holding the host
+    string line;
+    int lineNo = 0;
+    while(getline(in, line)) {
+        lineNo++;
+        line = line.substr(0, line.find('#'));
+        istringstream ss(line);
+        string kind, name;
+        if(!(ss >> kind)) continue;
+        if(kind == "allocator") {
+            string spec;
+            getline(ss, spec);
+            delete allocator;
+            allocator = makeAllocator(spec);
+            if(allocator == nullptr) {
+                cerr << "Invalid allocator at " << path << ":" << lineNo << endl;
+                return false;
+            }
+            continue;
+        }
+        int PP, DP, TP, microbatches, firstHost, numHosts, iterations;
+        double v[7], arrival;
+        if(kind != "job" || !(ss >> name >> PP >> DP >> TP >> microbatches
+                >> v[0] >> v[1] >> v[2] >> v[3] >> v[4] >> v[5] >> v[6]
+                >> firstHost >> numHosts >> arrival >> iterations)
+                || PP < 1 || DP < 1 || TP < 1 || firstHost < 0 || numHosts <= 0 || firstHost + numHosts > hosts.size() || iterations < 1) {
+            cerr << "Invalid job record at " << path << ":" << lineNo << endl;
+            return false;
+        }
+        if(numHosts < (long long)PP * DP * TP) {
+            cerr << "Job " << name << " at " << path << ":" << lineNo << " has " << numHosts << " hosts for "
+                 << PP * DP * TP << " ranks" << endl;
+            return false;
+        }
+        for(int h = firstHost; h < firstHost + numHosts; ++h) {
+            if(owner[h] != 0) {
+                cerr << "Hosts of job " << name << " at " << path << ":" << lineNo << " overlap the job at line "
+                     << owner[h] << endl;
+                return false;
+            }
+            owner[h] = lineNo;
+        }
+        Workload* job = new Workload(PP, DP, TP, microbatches, v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+        job->name = name;
+        job->topology = topology;
+        job->hosts.assign(hosts.begin() + firstHost, hosts.begin() + firstHost + numHosts);
+        job->arrivalTime = arrival;
+        job->iterations = iterations;
+        jobs.push_back(job);
+    }
+    return !jobs.empty();
+}
+
+double ClusterScenario::averageIterationTime(Workload* job){
+    if(job->iterationEnds.empty()) return 0;
+    return (job->iterationEnds.back() - job->arrivalTime) / job->iterationEnds.size();
+}
+
+void ClusterScenario::run(){
+    srand(0);
+    for(auto job : jobs) {
+        job->configureParallelism();
+        job->placement();
+        job->routing();
+    }
+
+    // all jobs together
+    Simulator* simulator = new Simulator();
+    simulator->workloads = jobs;
+    simulator->topology = topology;
+    simulator->allocator = allocator;
+    simulator->initialize();
+    simulator->run();
+    simulator->printJobs();
+    delete simulator;
+    vector<double> shared;
+    for(auto job : jobs) {
+        shared.push_back(averageIterationTime(job));
+    }
+
+    // each job alone, same placement and paths
+    cout << "Slowdown relative to running alone:" << endl;
+    for(int i = 0; i < jobs.size(); ++i) {
+        Simulator* alone = new Simulator();
+        alone->workloads.push_back(jobs[i]);
+        alone->topology = topology;
+        alone->allocator = allocator;
+        alone->verbose = false;
+        alone->initialize();
+        alone->run();
+        double isolated = averageIterationTime(jobs[i]);
+        delete alone;
+        cout << "  " << jobs[i]->name << ": shared " << shared[i] << ", alone " << isolated;
+        cout << ", slowdown " << (isolated > 0 ? shared[i] / isolated : 0) << endl;
+    }
+}
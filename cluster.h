@@ -0,0 +1,34 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "topology.h"
+#include "workload.h"
+#include "simulator.h"
+#include "allocator.h"
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+// Several training jobs sharing one topology, each placed on its own hosts.
+class ClusterScenario {
+public:
+    Topology* topology;
+    vector<Workload*> jobs;
+    Allocator* allocator;   // bandwidth sharing, max-min when null
+
+    ClusterScenario(Topology* topology) : topology(topology), allocator(nullptr) {}
+    ~ClusterScenario() {
+        for (auto job : jobs) {
+            delete job;
+        }
+        delete allocator;
+    }
+
+    bool load(const string& path);
+    double averageIterationTime(Workload* job);
+    void run();
+};
+
+#endif // CLUSTER_H
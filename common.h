@@ -1,6 +1,11 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+// Scheduled ends closer than this to the end of a round fall in it: what
+// is left of a compute, a latency or a flow (in seconds at its rate) is
+// rounding residue, not another event.
+const double TIME_RESOLUTION = 1e-12;   // seconds
+
 enum GroupType {
     TP,
     PP,
@@ -11,7 +16,21 @@ enum NodeType {
     HOST,
     TOR,
     AGG,
-    CORE
+    CORE,
+    NVSWITCH,   // intra-server GPU fabric
+    NIC         // scale-out NIC behind PCIe
+};
+
+enum MultipathMode {
+    SINGLE_PATH,    // one ECMP path per connection
+    SPRAY,          // static even split over equal-cost paths
+    ADAPTIVE        // split re-balanced onto the least-loaded paths every allocation
+};
+
+enum ActivationMode {
+    STORE_ACTIVATIONS,  // kept on the GPU from forward to backward
+    RECOMPUTE,          // only the stage input kept, the forward is recomputed in backward
+    OFFLOAD             // copied to host memory over PCIe after forward, prefetched before backward
 };
 
 enum RankState {
@@ -0,0 +1,145 @@
+#include "congestion.h"
+#include "common.h"
+
+#include <iostream>
+#include <limits>
+#include <cmath>
+#include <set>
+#include <algorithm>
+
+using namespace std;
+
+
+double CongestionControl::lineRate(Flow* flow){
+    double rate = numeric_limits<double>::infinity();
+    for(auto share : flow->linkShares) {
+        rate = min(rate, share.first->capacity / share.second);
+    }
+    return rate;
+}
+
+double CongestionControl::marking(Link* link){
+    auto it = queue.find(link);
+    double bytes = it != queue.end() ? it->second : 0;
+    if(bytes <= kmin) return 0;
+    if(bytes >= kmax) return 1;
+    return pmax * (bytes - kmin) / (kmax - kmin);
+}
+
+// Probability that a flow gets at least one CNP in an interval, and the
+// fluid DCQCN derivatives of its alpha, target rate and current rate.
+static void derivatives(CongestionControl* cc, Flow* flow, double& dAlpha, double& dTarget, double& dRate){
+    double unmarked = 1;
+    for(auto share : flow->linkShares) {
+        unmarked *= pow(1 - cc->marking(share.first), share.second);
+    }
+    double cnp = 1 - pow(unmarked, cc->tau * flow->rate / cc->mtu);
+    dAlpha = cc->g / cc->tau * (cnp - flow->alpha);
+    dTarget = -(flow->targetRate - flow->rate) / cc->tau * cnp + cc->additiveIncrease / cc->tau * (1 - cnp);
+    dRate = -flow->rate * flow->alpha / (2 * cc->tau) * cnp + (flow->targetRate - flow->rate) / (2 * cc->tau) * (1 - cnp);
+}
+
+void CongestionControl::allocate(vector<Flow*>& active, Allocator* fallback){
+    bool changed = active.size() != flows.size();
+    for(auto flow : active) {
+        if(!flow->controlled) {
+            flow->controlled = true;
+            flow->rate = flow->targetRate = initialRate * lineRate(flow);
+            flow->alpha = 1;
+            changed = true;
+        }
+    }
+    flows = active;
+    if(changed && stable) {
+        stable = false;
+        settledSteps = 0;
+    }
+    if(stable) {
+        fallback->allocate(active);
+        for(auto flow : active) {   // a later transient starts from the fair share
+            if(isfinite(flow->throughput)) flow->rate = flow->targetRate = flow->throughput;
+        }
+        return;
+    }
+
+    set<Link*> used;
+    for(auto flow : flows) {
+        for(auto share : flow->linkShares) {
+            used.insert(share.first);
+        }
+    }
+    links.assign(used.begin(), used.end());
+    for(auto link : links) {
+        link->arrival = 0;
+        link->flows.clear();
+        link->load = 0;
+    }
+    for(auto flow : flows) {
+        for(auto share : flow->linkShares) {
+            share.first->arrival += flow->rate * share.second;
+            share.first->flows.insert(flow);
+            share.first->load += share.second;
+        }
+    }
+    // a congested link serves its capacity, split in proportion to arrivals
+    for(auto link : links) {
+        bool congested = queue[link] > 0 || link->arrival > link->capacity;
+        link->throughput = congested ? link->capacity : link->arrival;
+    }
+    for(auto flow : flows) {
+        if(flow->linkShares.empty()) {
+            flow->throughput = numeric_limits<double>::infinity();
+            continue;
+        }
+        double factor = numeric_limits<double>::infinity();
+        for(auto share : flow->linkShares) {
+            Link* link = share.first;
+            factor = min(factor, link->throughput / link->arrival);
+        }
+        flow->throughput = flow->rate * factor;
+    }
+
+    // step: rates move at most 5% and queues a twentieth of the marking ramp
+    double dt = maxStep;
+    for(auto flow : flows) {
+        if(flow->linkShares.empty()) continue;
+        double dAlpha, dTarget, dRate;
+        derivatives(this, flow, dAlpha, dTarget, dRate);
+        if(dRate != 0) dt = min(dt, 0.05 * flow->rate / fabs(dRate));
+    }
+    for(auto link : links) {
+        double growth = link->arrival - link->capacity;
+        if(growth > 0 || queue[link] > 0) dt = min(dt, 0.05 * (kmax - kmin) / max(fabs(growth), 1e-9));
+    }
+    step = max(minStep, dt);
+}
+
+double CongestionControl::stableTime(){
+    if(stable || flows.empty()) return numeric_limits<double>::infinity();
+    return step;
+}
+
+void CongestionControl::progress(double time){
+    if(stable || flows.empty()) return;
+    transientTime += time;
+    double drift = 0;   // relative rate change per interval
+    for(auto flow : flows) {
+        if(flow->linkShares.empty()) continue;
+        double dAlpha, dTarget, dRate;
+        derivatives(this, flow, dAlpha, dTarget, dRate);
+        double line = lineRate(flow);
+        flow->alpha = min(1.0, max(0.0, flow->alpha + dAlpha * time));
+        flow->targetRate = min(line, max(line * 1e-4, flow->targetRate + dTarget * time));
+        flow->rate = min(line, max(line * 1e-4, flow->rate + dRate * time));
+        drift = max(drift, fabs(dRate) * tau / flow->rate);
+    }
+    bool queuesSettled = true;
+    for(auto link : links) {
+        double growth = link->arrival - link->capacity;
+        double& bytes = queue[link];
+        bytes = max(0.0, bytes + growth * time);
+        if(bytes > 0 && fabs(growth) * tau > tolerance * kmax) queuesSettled = false;
+    }
+    settledSteps = drift < tolerance && queuesSettled ? settledSteps + 1 : 0;
+    if(settledSteps >= 10) stable = true;
+}
@@ -0,0 +1,51 @@
+#ifndef CONGESTION_H
+#define CONGESTION_H
+
+#include "simulator.h"
+#include "topology.h"
+#include "allocator.h"
+
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// Fluid DCQCN-style congestion control. While flows start or finish, rates
+// follow the control law instead of jumping to their fair share: links
+// queue what exceeds their capacity and mark ECN between kmin and kmax, and
+// marked flows cut their rate by alpha/2 and recover towards a target rate.
+// The state is integrated with a step that adapts to how fast rates and
+// queues move; once they settle, the closed-form allocator takes over until
+// the set of flows changes again.
+class CongestionControl {
+public:
+    double kmin, kmax, pmax;    // ECN marking ramp (bytes in queue) and its peak probability
+    double g;                   // alpha gain
+    double tau;                 // rate update / CNP interval, seconds
+    double additiveIncrease;    // bytes/s added to the target rate per interval
+    double mtu;                 // bytes per packet, sets how often a flow can be marked
+    double initialRate;         // new flows start at this fraction of their line rate
+    double minStep, maxStep;    // bounds of the adaptive time step
+    double tolerance;           // relative rate drift per interval considered settled
+
+    CongestionControl() : kmin(5e3), kmax(200e3), pmax(0.01), g(1.0 / 256), tau(55e-6),
+        additiveIncrease(50e6), mtu(1000), initialRate(1.0), minStep(1e-8), maxStep(55e-6),
+        tolerance(1e-3), stable(true), step(0), settledSteps(0), transientTime(0) {}
+
+    bool stable;
+    double step;                // next integration step
+    int settledSteps;
+    double transientTime;       // simulated time spent integrating
+    vector<Flow*> flows;        // flows of the current round
+    vector<Link*> links;        // links they use
+    map<Link*, double> queue;   // bytes queued; here, not on the links, so forks keep their own
+
+    void allocate(vector<Flow*>& active, Allocator* fallback);
+    double stableTime();
+    void progress(double time);
+
+    double lineRate(Flow* flow);
+    double marking(Link* link);
+};
+
+#endif // CONGESTION_H
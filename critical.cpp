@@ -0,0 +1,175 @@
+#include "critical.h"
+
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+
+Activity* CriticalPath::create(bool compute, int id, int microbatch, Workload* workload){
+    activities.push_back(Activity());
+    Activity* activity = &activities.back();
+    activity->compute = compute;
+    activity->type = GroupType::TP;
+    activity->id = id;
+    activity->microbatch = microbatch;
+    activity->workload = workload;
+    activity->ready = activity->start = activity->end = now;
+    activity->cause = nullptr;
+    activity->bottleneck = nullptr;
+    activity->round = -1;
+    return activity;
+}
+
+void CriticalPath::computeStarted(RankTask* task){
+    task->computing = create(true, task->rank->id, task->microbatch, task->rank->workload);
+    task->computing->cause = task->released;
+}
+
+void CriticalPath::computeFinished(RankTask* task){
+    Activity* activity = task->computing;
+    if(activity == nullptr) return;
+    activity->end = now;
+    task->released = activity;
+    task->computing = nullptr;
+}
+
+// The last invocation to arrive releases the collective.
+void CriticalPath::invoked(Collective* collective, int rank){
+    Group* group = collective->group;
+    if(collective->activity == nullptr) {
+        collective->activity = create(false, group->id, collective->microbatch, group->workload);
+        collective->activity->type = group->type;
+    }
+    for(auto member : group->ranks) {
+        if(member->id != rank || member->rankTask == nullptr) continue;
+        Activity* cause = member->rankTask->released;
+        Activity* current = collective->activity->cause;
+        if(current == nullptr || (cause != nullptr && cause->end >= current->end)) collective->activity->cause = cause;
+    }
+}
+
+void CriticalPath::ready(Collective* collective){
+    if(collective->activity != nullptr) collective->activity->ready = now;
+}
+
+void CriticalPath::started(Collective* collective){
+    if(collective->activity != nullptr) collective->activity->start = now;
+}
+
+void CriticalPath::finished(Collective* collective, GroupTask* task){
+    Activity* activity = collective->activity;
+    if(activity == nullptr) return;
+    activity->end = now;
+    for(int side = 0; side < 2; ++side) {
+        for(auto rankTask : side == 0 ? task->senders : task->receivers) {
+            if(rankTask->released == nullptr || rankTask->released->end <= activity->end) rankTask->released = activity;
+        }
+    }
+    Activity*& latest = last[activity->workload];
+    if(latest == nullptr || latest->end <= activity->end) latest = activity;
+}
+
+// Bottleneck of each sending collective: the link the allocator froze its
+// flows on, or the most utilized link they cross when it does not say.
+void CriticalPath::allocated(vector<Flow*>& flows){
+    round++;
+    transferring.clear();
+    for(auto flow : flows) {
+        Activity* activity = flow->collective->activity;
+        if(activity == nullptr) continue;
+        if(activity->round != round) {
+            activity->round = round;
+            activity->bottleneck = nullptr;
+            transferring.push_back(activity);
+        }
+        if(activity->bottleneck != nullptr) continue;
+        Link* bottleneck = flow->bottleneck;
+        if(bottleneck == nullptr) {
+            double utilization = 0;
+            for(auto share : flow->linkShares) {
+                Link* link = share.first;
+                if(link->capacity > 0 && link->throughput / link->capacity > utilization) {
+                    utilization = link->throughput / link->capacity;
+                    bottleneck = link;
+                }
+            }
+        }
+        activity->bottleneck = bottleneck;
+    }
+}
+
+void CriticalPath::progress(double time){
+    for(auto activity : transferring) {
+        if(activity->bottleneck == nullptr) continue;
+        bool found = false;
+        for(auto& entry : activity->bottleneckTime) {
+            if(entry.first == activity->bottleneck) {
+                entry.second += time;
+                found = true;
+                break;
+            }
+        }
+        if(!found) activity->bottleneckTime.push_back(make_pair(activity->bottleneck, time));
+    }
+    now += time;
+}
+
+vector<Activity*> CriticalPath::path(Workload* workload){
+    vector<Activity*> path;
+    auto it = last.find(workload);
+    if(it == last.end()) return path;
+    for(Activity* activity = it->second; activity != nullptr; activity = activity->cause) {
+        path.push_back(activity);
+    }
+    reverse(path.begin(), path.end());
+    return path;
+}
+
+void CriticalPath::print(){
+    for(auto it : last) {
+        Workload* workload = it.first;
+        vector<Activity*> activities = path(workload);
+        double compute = 0, bubble = 0;
+        double comm[3] = {0, 0, 0};     // TP, PP, DP
+        map<Link*, double> linkTime;
+        double previous = workload->arrivalTime;
+        for(auto activity : activities) {
+            bubble += max(0.0, activity->start - previous);    // gap before ready and queueing behind the group
+            if(activity->compute) compute += activity->end - activity->start;
+            else comm[activity->type] += activity->end - activity->start;
+            for(auto entry : activity->bottleneckTime) {
+                linkTime[entry.first] += entry.second;
+            }
+            previous = activity->end;
+        }
+        double total = previous - workload->arrivalTime;
+        cout << "Critical path" << (workload->name.empty() ? "" : " of " + workload->name) << ": ";
+        cout << activities.size() << " activities, " << total << " s" << endl;
+        const char* names[] = {"TP", "PP", "DP"};
+        cout << "  compute " << compute << " (" << (total > 0 ? 100 * compute / total : 0) << "%)";
+        for(int t = 0; t < 3; ++t) {
+            cout << ", " << names[t] << " " << comm[t] << " (" << (total > 0 ? 100 * comm[t] / total : 0) << "%)";
+        }
+        cout << ", bubble " << bubble << " (" << (total > 0 ? 100 * bubble / total : 0) << "%)" << endl;
+
+        vector<pair<double, Link*>> ranked;
+        for(auto entry : linkTime) {
+            ranked.push_back(make_pair(entry.second, entry.first));
+        }
+        sort(ranked.begin(), ranked.end(), [](const pair<double, Link*>& a, const pair<double, Link*>& b) {
+            return a.first > b.first || (a.first == b.first && a.second->id < b.second->id);
+        });
+        if(ranked.size() > topLinks) ranked.resize(topLinks);
+        if(!ranked.empty()) cout << "  Bottleneck links on the path:" << endl;
+        for(auto entry : ranked) {
+            Link* link = entry.second;
+            cout << "    ";
+            // pseudo-links from a node to itself: a GPU's PCIe to host memory, a switch's reduction engine
+            if(link->src == link->dst && link->src->type == HOST) cout << "Host " << link->src->id << " PCIe";
+            else if(link->src == link->dst) cout << "Switch " << link->src->id << " aggregation";
+            else cout << "Link " << link->id << " (" << link->src->id << " -> " << link->dst->id << ")";
+            cout << ": " << entry.first << " s" << endl;
+        }
+    }
+}
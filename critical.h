@@ -0,0 +1,63 @@
+#ifndef CRITICAL_H
+#define CRITICAL_H
+
+#include "common.h"
+#include "simulator.h"
+#include "topology.h"
+
+#include <vector>
+#include <deque>
+#include <map>
+
+using namespace std;
+
+// A compute phase of a rank or a collective, a node of the dependency graph
+// recorded during the run. cause is the activity whose completion released
+// it: the last event that unblocked the rank, or the last invoker of the
+// collective.
+class Activity {
+public:
+    bool compute;
+    GroupType type;         // collectives
+    int id;                 // rank or group
+    int microbatch;
+    Workload* workload;
+    double ready, start, end;   // a collective may queue behind its group between ready and start
+    Activity* cause;
+
+    Link* bottleneck;       // of the collective's flows in the current round
+    int round;
+    vector<pair<Link*, double>> bottleneckTime;
+};
+
+// Records the activities and the dependency that released each one, then
+// walks back from the last activity of each job: the time along that path
+// splits into compute, TP, PP, DP and bubble (waiting for a busy group or
+// for the job to start), and the links that bottlenecked the collectives
+// on it are ranked by time.
+class CriticalPath {
+public:
+    int topLinks;
+    CriticalPath(int topLinks = 10) : topLinks(topLinks), now(0), round(0) {}
+
+    double now;
+    int round;
+    deque<Activity> activities;
+    map<Workload*, Activity*> last;     // latest finishing activity per job
+    vector<Activity*> transferring;     // collectives sending in this round
+
+    Activity* create(bool compute, int id, int microbatch, Workload* workload);
+    void computeStarted(RankTask* task);
+    void computeFinished(RankTask* task);
+    void invoked(Collective* collective, int rank);
+    void ready(Collective* collective);
+    void started(Collective* collective);
+    void finished(Collective* collective, GroupTask* task);
+    void allocated(vector<Flow*>& flows);
+    void progress(double time);
+
+    vector<Activity*> path(Workload* workload);     // first activity first
+    void print();
+};
+
+#endif // CRITICAL_H
@@ -0,0 +1,458 @@
+#include "distributed.h"
+#include "common.h"
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+
+template<class T> static void put(string& block, T value){
+    block.append((const char*)&value, sizeof(T));
+}
+
+template<class T> static T take(const string& block, size_t& at){
+    T value;
+    memcpy(&value, block.data() + at, sizeof(T));
+    at += sizeof(T);
+    return value;
+}
+
+static bool sendAll(int fd, const char* data, size_t size){
+    while(size > 0) {
+        ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+        if(sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool receiveAll(int fd, char* data, size_t size){
+    while(size > 0) {
+        ssize_t received = ::recv(fd, data, size, 0);
+        if(received <= 0) return false;
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+static bool sendBlock(int fd, const string& block){
+    uint64_t size = block.size();
+    return sendAll(fd, (const char*)&size, sizeof(size)) && sendAll(fd, block.data(), block.size());
+}
+
+static bool receiveBlock(int fd, string& block){
+    uint64_t size;
+    if(!receiveAll(fd, (char*)&size, sizeof(size))) return false;
+    block.resize(size);
+    return receiveAll(fd, &block[0], size);
+}
+
+static void noDelay(int fd){
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+Transport::~Transport(){
+    for(auto fd : sockets) {
+        if(fd >= 0) ::close(fd);
+    }
+    if(listener >= 0) ::close(listener);
+}
+
+bool Transport::listen(int port){
+    listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    socklen_t length = sizeof(address);
+    if(listener < 0 || ::bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(listener, processes) != 0
+       || getsockname(listener, (sockaddr*)&address, &length) != 0) {
+        cerr << "Cannot listen on port " << port << ": " << strerror(errno) << endl;
+        return false;
+    }
+    this->port = ntohs(address.sin_port);
+    return true;
+}
+
+bool Transport::accept(){
+    sockets.assign(processes, -1);
+    for(int i = 1; i < processes; ++i) {
+        int fd = ::accept(listener, nullptr, nullptr);
+        int32_t peer;
+        if(fd < 0 || !receiveAll(fd, (char*)&peer, sizeof(peer)) || peer <= 0 || peer >= processes || sockets[peer] >= 0) {
+            cerr << "Bad connection from a simulator process" << endl;
+            if(fd >= 0) ::close(fd);
+            return false;
+        }
+        noDelay(fd);
+        sockets[peer] = fd;
+    }
+    return true;
+}
+
+bool Transport::connect(const string& host, int port){
+    addrinfo hints, *found;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &found) != 0) {
+        cerr << "Unknown host " << host << endl;
+        return false;
+    }
+    int fd = -1;
+    for(int attempt = 0; attempt < 200 && fd < 0; ++attempt) {    // process 0 may still be starting
+        fd = ::socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+        if(::connect(fd, found->ai_addr, found->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+            this_thread::sleep_for(chrono::milliseconds(50));
+        }
+    }
+    freeaddrinfo(found);
+    int32_t self = index;
+    if(fd < 0 || !sendAll(fd, (const char*)&self, sizeof(self))) {
+        cerr << "Cannot reach process 0 at " << host << ":" << port << endl;
+        return false;
+    }
+    noDelay(fd);
+    sockets.assign(1, fd);
+    return true;
+}
+
+vector<string> Transport::exchange(const string& block){
+    vector<string> blocks(processes);
+    if(processes == 1) {
+        blocks[0] = block;
+        return blocks;
+    }
+    bool ok = true;
+    if(index == 0) {
+        blocks[0] = block;
+        for(int i = 1; i < processes && ok; ++i) {
+            ok = receiveBlock(sockets[i], blocks[i]);
+            bytes += blocks[i].size() + sizeof(uint64_t);
+        }
+        string all;
+        for(auto& b : blocks) {
+            put<uint64_t>(all, b.size());
+            all += b;
+        }
+        for(int i = 1; i < processes && ok; ++i) {
+            ok = sendAll(sockets[i], all.data(), all.size());
+        }
+        bytes += all.size() * (processes - 1);
+    }
+    else {
+        ok = sendBlock(sockets[0], block);
+        bytes += block.size() + sizeof(uint64_t);
+        for(int i = 0; i < processes && ok; ++i) {
+            ok = receiveBlock(sockets[0], blocks[i]);
+            bytes += blocks[i].size() + sizeof(uint64_t);
+        }
+    }
+    if(!ok) {
+        cerr << "Process " << index << " lost its connection, stopping" << endl;
+        exit(1);
+    }
+    return blocks;
+}
+
+
+void BoundaryRankTask::notify(int endpoint, GroupTask* groupTask, int microbatch){
+    if(endpoint == EndpointType::RECV) partition->outbox.push_back(make_pair(rank->id, microbatch));
+}
+
+Partition::Partition(Workload* workload, Transport* transport, int threads) : workload(workload), transport(transport){
+    firstStage = workload->PP * transport->index / transport->processes;
+    lastStage = workload->PP * (transport->index + 1) / transport->processes;
+    ranks = 0;
+    for(auto rank : workload->ranks) {
+        if(owns(rank)) ranks++;
+    }
+    pool = new WorkerPool(threads);
+    allocator = new ParallelMaxMinAllocator(pool);
+    load.assign(workload->topology->links.size(), -1);
+}
+
+Partition::~Partition(){
+    for(auto it : boundary) {
+        delete it.second;
+    }
+    delete allocator;
+    delete pool;
+}
+
+bool Partition::owns(Rank* rank){
+    return rank->pp >= firstStage && rank->pp < lastStage;
+}
+
+bool Partition::owns(Group* group){
+    return owns(group->ranks[0]);   // a PP group's sender
+}
+
+RankTask* Partition::boundaryTask(Rank* rank){
+    auto it = boundary.find(rank->id);
+    if(it != boundary.end()) return it->second;
+    BoundaryRankTask* task = new BoundaryRankTask(rank, this);
+    boundary[rank->id] = task;
+    return task;
+}
+
+vector<string> Partition::exchange(const string& block){
+    auto start = chrono::steady_clock::now();
+    vector<string> blocks = transport->exchange(block);
+    waiting += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return blocks;
+}
+
+// Loads are summed from 0 in process order, the same on every process, and
+// links are taken by id, so every process fills the same way. Links without
+// an id (PCIe copies) only carry this process's flows. Each block starts
+// with the process's PP arrivals.
+void Partition::allocate(vector<Flow*>& flows){
+    Topology* topology = workload->topology;
+    vector<Link*> local;
+    for(auto flow : flows) {
+        for(auto share : flow->linkShares) {
+            Link* link = share.first;
+            if(link->id < 0) {
+                if(find(local.begin(), local.end(), link) == local.end()) {
+                    local.push_back(link);
+                    link->load = 0;
+                }
+                link->load += share.second;
+                continue;
+            }
+            if(load[link->id] < 0) {
+                load[link->id] = 0;
+                touched.push_back(link->id);
+            }
+            load[link->id] += share.second;
+        }
+    }
+    sort(touched.begin(), touched.end());
+    string block;
+    put<int32_t>(block, outbox.size());
+    for(auto arrival : outbox) {
+        put<int32_t>(block, arrival.first);
+        put<int32_t>(block, arrival.second);
+    }
+    outbox.clear();
+    rounds++;
+    for(auto id : touched) {
+        put<int32_t>(block, id);
+        put<double>(block, load[id]);
+        load[id] = -1;
+    }
+    touched.clear();
+    delivered = 0;
+    for(auto& b : exchange(block)) {
+        size_t at = 0;
+        int arrivals = take<int32_t>(b, at);
+        for(int i = 0; i < arrivals; ++i) {
+            Rank* rank = workload->ranks[take<int32_t>(b, at)];
+            int microbatch = take<int32_t>(b, at);
+            if(!owns(rank)) continue;
+            rank->rankTask->events.push_back(make_tuple(EndpointType::RECV, GroupType::PP, microbatch));
+            delivered++;
+        }
+        while(at < b.size()) {
+            int id = take<int32_t>(b, at);
+            double part = take<double>(b, at);
+            if(load[id] < 0) {
+                load[id] = 0;
+                touched.push_back(id);
+            }
+            load[id] += part;
+        }
+    }
+    sort(touched.begin(), touched.end());
+    vector<Link*> links;
+    for(auto id : touched) {
+        topology->links[id]->load = load[id];
+        links.push_back(topology->links[id]);
+        load[id] = -1;
+    }
+    touched.clear();
+    links.insert(links.end(), local.begin(), local.end());
+    allocator->fill(flows, links);
+}
+
+double Partition::stableTime(double local){
+    string block;
+    put<double>(block, local);
+    double time = numeric_limits<double>::infinity();
+    for(auto& b : exchange(block)) {
+        size_t at = 0;
+        time = min(time, take<double>(b, at));
+    }
+    return time;
+}
+
+static double peakResident(){
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss * 1024.0;    // kilobytes on Linux
+}
+
+// An iteration ends when the last process's ranks have finished it.
+void Partition::finish(){
+    string block;
+    put<double>(block, peakResident());
+    for(auto end : workload->iterationEnds) {
+        put<double>(block, end);
+    }
+    vector<double> ends;
+    bool first = true;
+    memory.clear();
+    for(auto& b : exchange(block)) {
+        vector<double> own;
+        size_t at = 0;
+        memory.push_back(take<double>(b, at));
+        while(at < b.size()) own.push_back(take<double>(b, at));
+        if(first) ends = own;
+        ends.resize(min(ends.size(), own.size()));
+        for(int i = 0; i < ends.size(); ++i) {
+            ends[i] = max(ends[i], own[i]);
+        }
+        first = false;
+    }
+    workload->iterationEnds = ends;
+}
+
+
+double runPartition(Topology* topology, Workload* workload, Transport* transport, int threads, bool verbose,
+                    vector<double>* memory){
+    Partition partition(workload, transport, threads);
+    Simulator simulator;
+    simulator.workloads.push_back(workload);
+    simulator.topology = topology;
+    simulator.verbose = verbose;
+    simulator.partition = &partition;
+    simulator.initialize();
+    simulator.run();
+    if(verbose) {
+        cout << "Distributed: " << transport->processes << " processes, process " << transport->index
+             << " ran stages " << partition.firstStage << "-" << partition.lastStage - 1 << " (" << partition.ranks
+             << " ranks), " << partition.rounds << " rounds, " << transport->bytes / 1e6 << " MB exchanged, "
+             << partition.waiting << " s waiting on the others, peak memory";
+        for(auto bytes : partition.memory) cout << " " << bytes / 1e6;
+        cout << " MB by process" << endl;
+    }
+    if(memory != nullptr) *memory = partition.memory;
+    return simulator.globalTime;
+}
+
+double runDistributed(Topology* topology, Workload* workload, int processes, int threads, bool verbose,
+                      vector<double>* memory){
+    if(workload->trace != nullptr || workload->inNetworkAggregation || processes < 1 || processes > workload->PP) {
+        cerr << "A distributed run needs a 1F1B workload without in-network aggregation and 1 to PP processes" << endl;
+        return -1;
+    }
+    Transport hub(0, processes);
+    if(processes > 1 && !hub.listen(0)) return -1;
+    cout.flush();
+    vector<pid_t> children;
+    for(int i = 1; i < processes; ++i) {
+        pid_t pid = fork();
+        if(pid == 0) {
+            Transport transport(i, processes);
+            if(!transport.connect("127.0.0.1", hub.port)) _exit(1);
+            runPartition(topology, workload, &transport, threads, false);
+            _exit(0);
+        }
+        children.push_back(pid);
+    }
+    double time = -1;
+    if(hub.accept()) time = runPartition(topology, workload, &hub, threads, verbose, memory);
+    for(auto pid : children) {
+        int status;
+        waitpid(pid, &status, 0);
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) time = -1;
+    }
+    return time;
+}
+
+// Runs `body` in a child, so that its memory peak starts from this
+// process's, and returns the block it produced; empty if the child failed.
+static string inChild(const function<string()>& body){
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return "";
+    cout.flush();
+    pid_t pid = fork();
+    if(pid == 0) {
+        ::close(fds[0]);
+        _exit(sendBlock(fds[1], body()) ? 0 : 1);
+    }
+    ::close(fds[1]);
+    string block;
+    if(pid < 0 || !receiveBlock(fds[0], block)) block.clear();
+    ::close(fds[0]);
+    int status;
+    if(pid > 0) waitpid(pid, &status, 0);
+    return block;
+}
+
+void scalingBenchmark(Topology* topology, Workload* workload, int maxProcesses, int threads){
+    string single = inChild([&]() {
+        Simulator* simulator = new Simulator();
+        simulator->workloads.push_back(workload);
+        simulator->topology = topology;
+        simulator->verbose = false;
+        simulator->initialize();
+        auto start = chrono::steady_clock::now();
+        simulator->run();
+        string result;
+        put<double>(result, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        put<double>(result, simulator->globalTime);
+        put<double>(result, peakResident());
+        return result;
+    });
+    if(single.empty()) return;
+    size_t at = 0;
+    double wall = take<double>(single, at);
+    double reference = take<double>(single, at);
+    cout << "Scaling of " << workload->PP * workload->DP * workload->TP << " ranks:" << endl;
+    cout << "  single process: " << wall * 1000 << " ms, time " << reference << " s, peak memory "
+         << take<double>(single, at) / 1e6 << " MB" << endl;
+    for(int processes = 1; processes <= min(maxProcesses, workload->PP); processes *= 2) {
+        string run = inChild([&]() {
+            vector<double> memory;
+            auto start = chrono::steady_clock::now();
+            double time = runDistributed(topology, workload, processes, threads, false, &memory);
+            string result;
+            put<double>(result, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+            put<double>(result, time);
+            for(auto bytes : memory) put<double>(result, bytes);
+            return result;
+        });
+        at = 0;
+        double distributed = run.empty() ? 0 : take<double>(run, at);
+        double time = run.empty() ? -1 : take<double>(run, at);
+        if(time < 0) return;
+        cout << "  " << processes << " processes: " << distributed * 1000 << " ms, speedup " << wall / distributed
+             << ", time " << time << " s (" << (time - reference) / reference << " relative to one process), peak memory";
+        while(at < run.size()) cout << " " << take<double>(run, at) / 1e6;
+        cout << " MB by process" << endl;
+    }
+}
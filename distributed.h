@@ -0,0 +1,106 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "topology.h"
+#include "workload.h"
+#include "simulator.h"
+#include "allocator.h"
+#include "parallel.h"
+
+#include <vector>
+#include <string>
+#include <map>
+
+using namespace std;
+
+// TCP star between the processes of a distributed run, process 0 in the
+// middle. Processes on other machines join with the same arguments.
+class Transport {
+public:
+    int index, processes;
+    int port;                   // process 0's, after listen()
+    long long bytes = 0;        // sent and received by this process
+
+    Transport(int index, int processes) : index(index), processes(processes), port(0) {}
+    ~Transport();
+
+    bool listen(int port);      // process 0, before the others connect; 0 picks a free port
+    bool accept();              // process 0: every other process, which names its index
+    bool connect(const string& host, int port);
+
+    // every process gives a block and gets all blocks, by process index;
+    // a lost connection ends the process, the run cannot go on without it
+    vector<string> exchange(const string& block);
+
+private:
+    int listener = -1;
+    vector<int> sockets;        // process 0: by index; others: [0] to process 0
+};
+
+class Partition;
+
+// Receiver of a PP transfer whose rank lives in another process: the
+// arrival is mailed at the end of the round.
+class BoundaryRankTask : public RankTask {
+public:
+    Partition* partition;
+    BoundaryRankTask(Rank* rank, Partition* partition) : RankTask(rank), partition(partition) {}
+    void notify(int endpoint, GroupTask* groupTask, int microbatch);
+};
+
+// One process's share of a 1F1B workload, a contiguous block of pipeline
+// stages. TP and DP groups stay inside a stage, so only PP transfers cross
+// processes; their groups belong to the sending side. Rounds stay global,
+// with two exchanges each: the link loads of all processes' flows are
+// summed for the allocation, and every process advances by the smallest
+// stable time of all. The water filling runs on the same links and loads
+// everywhere and gives each process the rates of its own flows. The PP
+// arrivals of the last round travel with the loads; an arrival only moves
+// a waiting rank into its compute, which starts no flows, so it is handled
+// after the allocation. Loads are summed per process, so times can differ
+// from a single process in the last bits.
+class Partition {
+public:
+    Workload* workload;
+    Transport* transport;
+    int firstStage, lastStage;  // [first, last)
+    int ranks;                  // owned
+
+    Partition(Workload* workload, Transport* transport, int threads = 1);
+    ~Partition();
+
+    bool owns(Rank* rank);
+    bool owns(Group* group);
+    RankTask* boundaryTask(Rank* rank);
+
+    vector<pair<int, int>> outbox;  // < rank, microbatch > PP arrivals for other processes
+    int delivered = 0;              // arrivals from the others in the last allocate()
+    void allocate(vector<Flow*>& flows);    // and the arrivals
+    double stableTime(double local);
+    void finish();                  // iteration ends of the whole workload, memory
+
+    int rounds = 0;
+    double waiting = 0;             // seconds in exchange()
+    vector<double> memory;          // peak resident bytes by process, after finish()
+
+private:
+    WorkerPool* pool;
+    ParallelMaxMinAllocator* allocator;
+    map<int, BoundaryRankTask*> boundary;
+    vector<double> load;            // by link id
+    vector<int> touched;
+    vector<string> exchange(const string& block);
+};
+
+// Runs the workload on `processes` forked processes of this machine,
+// connected over loopback, and returns the simulated time.
+double runDistributed(Topology* topology, Workload* workload, int processes, int threads = 1, bool verbose = true,
+                      vector<double>* memory = nullptr);
+// One process of a run, e.g. on another machine; transport connected
+double runPartition(Topology* topology, Workload* workload, Transport* transport, int threads = 1, bool verbose = true,
+                    vector<double>* memory = nullptr);
+// Wall time and peak memory per process with 1, 2, 4, ... processes
+// against the single-process run, each measured in a fork of this process
+void scalingBenchmark(Topology* topology, Workload* workload, int maxProcesses, int threads = 1);
+
+#endif // DISTRIBUTED_H
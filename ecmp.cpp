@@ -0,0 +1,162 @@
+#include "ecmp.h"
+#include "common.h"
+
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <tuple>
+#include <cmath>
+
+using namespace std;
+
+
+// Flows of one collective always share a rate, so the allocation depends
+// only on how many connections of each group cross each link: routings with
+// the same (link, group, share) multiset give the same iteration time.
+static vector<tuple<int, int, double>> linkLoadSignature(Workload* workload, vector<int>& connectionsPerLink){
+    vector<tuple<int, int, double>> entries;
+    for(auto group : workload->groups) {
+        for(auto conn : group->connections) {
+            if(conn->linkShares.empty()) {
+                for(auto link : conn->pathLinks) {
+                    if(link->id < 0) continue;  // pseudo-links do not depend on routing
+                    entries.push_back(make_tuple(link->id, group->id, 1.0));
+                    connectionsPerLink[link->id]++;
+                }
+            }
+            else {
+                for(auto share : conn->linkShares) {
+                    if(share.first->id < 0) continue;
+                    entries.push_back(make_tuple(share.first->id, group->id, share.second));
+                    connectionsPerLink[share.first->id]++;
+                }
+            }
+        }
+    }
+    sort(entries.begin(), entries.end());
+    return entries;
+}
+
+void EcmpStudy::worker(){
+    Topology* replica = topology->clone();
+    Workload* job = workload->replicate(replica);
+    mt19937 rng;
+    replica->rng = &rng;
+    vector<int> load(replica->links.size());
+    vector<bool> fabric;    // switch-to-switch links, the ones ECMP chooses between
+    for(auto link : replica->links) {
+        bool edge = false;
+        for(auto node : {link->src, link->dst}) {
+            if(node->type == HOST || node->type == NIC || node->type == NVSWITCH) edge = true;
+        }
+        fabric.push_back(!edge);
+    }
+
+    while(true) {
+        int seed = nextSeed++;
+        if(seed >= seeds) break;
+        rng.seed(firstSeed + seed);
+        job->routing();
+        fill(load.begin(), load.end(), 0);
+        vector<tuple<int, int, double>> signature = linkLoadSignature(job, load);
+
+        // the first seed with a link load reserves it, later ones wait for its time
+        double time = -1;
+        bool reserved = false;
+        {
+            unique_lock<mutex> guard(lock);
+            auto it = simulated.find(signature);
+            if(it == simulated.end()) {
+                simulated[signature] = -1;
+                reserved = true;
+            }
+            else {
+                deduplicated++;
+                finished.wait(guard, [&]() { return it->second >= 0; });
+                time = it->second;
+            }
+        }
+        if(reserved) {
+            Simulator* simulator = new Simulator();
+            simulator->workloads.push_back(job);
+            simulator->topology = replica;
+            simulator->verbose = false;
+            simulator->initialize();
+            simulator->run();
+            time = simulator->globalTime;
+            delete simulator;
+        }
+
+        int maxLoad = 0;
+        for(int l = 0; l < load.size(); ++l) {
+            if(fabric[l]) maxLoad = max(maxLoad, load[l]);
+        }
+        lock_guard<mutex> guard(lock);
+        if(reserved) {
+            simulated[signature] = time;
+            finished.notify_all();
+        }
+        times[seed] = time;
+        for(int l = 0; l < load.size(); ++l) {
+            if(!fabric[l]) continue;
+            if(load[l] > worstLoad[l] || (load[l] == worstLoad[l] && seed < worstSeed[l])) {
+                worstLoad[l] = load[l];
+                worstSeed[l] = seed;
+            }
+            if(load[l] == maxLoad && maxLoad > 0) hotSeeds[l]++;
+        }
+    }
+    delete job;
+    delete replica;
+}
+
+void EcmpStudy::run(){
+    times.assign(seeds, 0);
+    worstLoad.assign(topology->links.size(), 0);
+    worstSeed.assign(topology->links.size(), -1);
+    hotSeeds.assign(topology->links.size(), 0);
+    simulated.clear();
+    deduplicated = 0;
+    nextSeed = 0;
+
+    vector<thread> workers;
+    for(int t = 0; t < max(1, threads); ++t) {
+        workers.push_back(thread(&EcmpStudy::worker, this));
+    }
+    for(auto& t : workers) {
+        t.join();
+    }
+}
+
+void EcmpStudy::print(){
+    vector<double> sorted = times;
+    sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) {   // nearest rank
+        int index = (int)ceil(p / 100 * sorted.size()) - 1;
+        return sorted[max(0, min((int)sorted.size() - 1, index))];
+    };
+    double mean = 0;
+    for(auto t : sorted) mean += t;
+    mean /= sorted.size();
+
+    cout << "ECMP study: " << seeds << " seeds, " << simulated.size() << " distinct link loads, "
+         << deduplicated << " deduplicated, " << max(1, threads) << " threads" << endl;
+    cout << "Iteration time: min " << sorted.front() << ", p50 " << percentile(50)
+         << ", p95 " << percentile(95) << ", p99 " << percentile(99)
+         << ", max " << sorted.back() << ", mean " << mean << endl;
+
+    vector<int> order;
+    for(int l = 0; l < worstLoad.size(); ++l) {
+        if(worstLoad[l] > 0) order.push_back(l);
+    }
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        return make_tuple(-worstLoad[a], -hotSeeds[a], a) < make_tuple(-worstLoad[b], -hotSeeds[b], b);
+    });
+    cout << "Hot fabric links (most connections sharing a link):" << endl;
+    for(int i = 0; i < min((int)order.size(), 10); ++i) {
+        Link* link = topology->links[order[i]];
+        cout << "  Link " << link->id << " (" << link->src->id << " -> " << link->dst->id << "): "
+             << worstLoad[link->id] << " connections in seed " << worstSeed[link->id]
+             << " (" << times[worstSeed[link->id]] << "), most loaded in " << hotSeeds[link->id] << " seeds" << endl;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef ECMP_H
+#define ECMP_H
+
+#include "topology.h"
+#include "workload.h"
+#include "simulator.h"
+
+#include <vector>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+using namespace std;
+
+// Monte Carlo over ECMP routing seeds. Every worker thread routes and
+// simulates its own replica of the topology and workload, seeded per run,
+// so results depend only on the seed, not on the thread count.
+class EcmpStudy {
+public:
+    Topology* topology;
+    Workload* workload;     // 1F1B workload, replicated per thread
+    int seeds;
+    int threads;
+    unsigned firstSeed;
+
+    EcmpStudy(Topology* topology, Workload* workload, int seeds, int threads) :
+        topology(topology), workload(workload), seeds(seeds), threads(threads), firstSeed(0) {}
+
+    vector<double> times;               // per seed
+    vector<int> worstLoad;              // link id -> most connections sharing it in any seed
+    vector<int> worstSeed;              // link id -> seed of that load
+    vector<int> hotSeeds;               // link id -> seeds in which it was a most loaded link
+    map<vector<tuple<int, int, double>>, double> simulated;    // sorted (link, group, share) -> iteration time, -1 while simulating
+    int deduplicated;
+
+    void worker();
+    void run();
+    void print();
+
+    atomic<int> nextSeed;
+    mutex lock;         // guards the shared results
+    condition_variable finished;    // a reserved link load got its time
+};
+
+#endif // ECMP_H
@@ -0,0 +1,311 @@
+#include "fault.h"
+#include "common.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <set>
+#include <map>
+#include <limits>
+
+using namespace std;
+
+
+// Flows of a tree collective follow their rank's connection to the new tree.
+static void moveTree(Collective* collective, vector<Connection*>& oldTree){
+    vector<Connection*>& tree = collective->group->aggregation;
+    for(auto flow : collective->flows) {
+        int index = find(oldTree.begin(), oldTree.end(), flow->connection) - oldTree.begin();
+        flow->connection = tree[index];
+        flow->route();
+    }
+}
+
+// A tree flow carries the reduced data once, a ring flow 2(n-1)/n times
+// as much; what is left of the slowest tree flow goes on over the ring.
+static void leaveTree(Collective* collective){
+    Group* group = collective->group;
+    Topology* topology = group->workload->topology;
+    double remaining = 0;
+    for(auto flow : collective->flows) {
+        remaining = max(remaining, flow->remainingSize);
+        delete flow;
+    }
+    collective->flows.clear();
+    double factor = 2.0 * (group->ranks.size() - 1) / group->ranks.size();
+    for(auto connection : group->connections) {
+        Flow* flow = new Flow(connection);
+        flow->remainingSize = remaining * factor;
+        flow->collective = collective;
+        collective->flows.push_back(flow);
+    }
+    collective->aggregated = false;
+    topology->activeAggregationTrees--;
+    topology->aggregationFallbacks++;
+    if(collective->remainingLatency > 0) collective->remainingLatency = collective->latency();
+}
+
+// A failed cable takes both directions down; a degraded one runs both at
+// the new capacity. Only connections crossing a failed link are rerouted,
+// and the flows already created for them move to the new path. Flows left
+// without a path stall until a link comes back.
+void Simulator::applyFault(LinkFault& fault){
+    Link* pair[2] = {fault.link, topology->reverse(fault.link)};
+    bool fails = fault.capacity <= 0;
+    bool repaired = false;
+    for(auto link : pair) {
+        if(link == nullptr) continue;
+        if(link->failed && !fails) repaired = true;
+        link->capacity = max(0.0, fault.capacity);
+        link->failed = fails;
+    }
+    if(verbose) {
+        cout << "Time " << globalTime << ": link " << fault.link->id << (fails ? " failed" : " degraded to ")
+             << (fails ? "" : to_string(fault.capacity)) << endl;
+    }
+    if(!fails && !repaired) return;  // the allocator picks up the new capacity next round
+
+    // a repaired link may reconnect connections an earlier failure cut off
+    topology->routingReady = false;
+    set<Connection*> rerouted;
+    for(auto workload : workloads) {
+        for(auto group : workload->groups) {
+            for(auto conn : group->connections) {
+                bool crosses = false;
+                for(auto link : conn->pathLinks) {
+                    if(link == pair[0] || link == pair[1]) crosses = true;
+                }
+                if(fails ? !crosses : !conn->pathLinks.empty() || conn->src->host == conn->dst->host) continue;
+                workload->routeConnection(conn);
+                rerouted.insert(conn);
+                if(conn->pathLinks.empty() && conn->src->host != conn->dst->host) {
+                    cerr << "Rank " << conn->src->id << " -> " << conn->dst->id << " disconnected, its flows stall" << endl;
+                }
+            }
+        }
+    }
+    reroutedConnections += rerouted.size();
+
+    // reduction trees over a failed link are built again, a group left
+    // without one falls back to the ring
+    map<Group*, vector<Connection*>> replacedTrees;
+    for(auto workload : workloads) {
+        for(auto group : workload->groups) {
+            if(!fails || group->aggregation.empty()) continue;
+            bool crosses = false;
+            for(auto conn : group->aggregation) {
+                for(auto link : conn->pathLinks) {
+                    if(link == pair[0] || link == pair[1]) crosses = true;
+                }
+            }
+            if(!crosses) continue;
+            replacedTrees[group] = group->aggregation;
+            rebuiltTrees.insert(group);
+            group->aggregation.clear();
+            workload->routeAggregation(group);
+            if(verbose && group->aggregation.empty()) cout << "DP group " << group->id << " falls back to the ring" << endl;
+        }
+    }
+
+    // migrate flows of created collectives
+    for(auto task : tasks) {
+        GroupTask* groupTask = dynamic_cast<GroupTask*>(task);
+        if(groupTask == nullptr) continue;
+        vector<Collective*> collectives = groupTask->waitingCollectives;
+        if(groupTask->activeCollective != nullptr) collectives.push_back(groupTask->activeCollective);
+        for(auto it : groupTask->accumulatingCollectives) collectives.push_back(it.second);
+        auto tree = replacedTrees.find(groupTask->group);
+        for(auto collective : collectives) {
+            if(collective->aggregated && tree != replacedTrees.end()) {
+                if(groupTask->group->aggregation.empty()) leaveTree(collective);
+                else moveTree(collective, tree->second);
+                migratedFlows += collective->flows.size();
+                continue;
+            }
+            for(auto flow : collective->flows) {
+                if(rerouted.count(flow->connection) == 0) continue;
+                flow->route();
+                migratedFlows++;
+            }
+        }
+    }
+    for(auto& tree : replacedTrees) {
+        for(auto connection : tree.second) {
+            delete connection;
+        }
+    }
+}
+
+
+// Schedule file, '#' starts a comment:
+//   scenario <name>
+//   fault <time> <link id> <capacity>     (capacity 0: the link fails)
+//   allocator <spec>                       (see makeAllocator, all runs)
+bool FaultStudy::load(const string& path){
+    ifstream in(path);
+    if(!in.is_open()) {
+        cerr << "Cannot open fault schedule " << path << endl;
+        return false;
+    }
+    string line;
+    int lineNo = 0;
+    while(getline(in, line)) {
+        lineNo++;
+        line = line.substr(0, line.find('#'));
+        istringstream ss(line);
+        string kind;
+        if(!(ss >> kind)) continue;
+        if(kind == "allocator") {
+            string spec;
+            getline(ss, spec);
+            delete allocator;
+            allocator = makeAllocator(spec);
+            if(allocator == nullptr) {
+                cerr << "Invalid allocator at " << path << ":" << lineNo << endl;
+                return false;
+            }
+            continue;
+        }
+        if(kind == "scenario") {
+            string name;
+            ss >> name;
+            names.push_back(name);
+            scenarios.push_back(vector<LinkFault>());
+            continue;
+        }
+        LinkFault fault;
+        int link;
+        if(kind != "fault" || !(ss >> fault.time >> link >> fault.capacity) || link < 0 || link >= topology->links.size()) {
+            cerr << "Invalid fault record at " << path << ":" << lineNo << endl;
+            return false;
+        }
+        fault.link = topology->links[link];
+        if(scenarios.empty()) {
+            names.push_back("faults");
+            scenarios.push_back(vector<LinkFault>());
+        }
+        scenarios.back().push_back(fault);
+    }
+    for(auto& faults : scenarios) {
+        stable_sort(faults.begin(), faults.end(), [](const LinkFault& a, const LinkFault& b) {
+            return a.time < b.time;
+        });
+    }
+    return !scenarios.empty();
+}
+
+double FaultStudy::simulate(vector<LinkFault>& faults, int& rerouted, int& migrated, bool& finished){
+    // remember what the faults change
+    vector<vector<Node*>> paths;
+    vector<vector<Link*>> pathLinks;
+    vector<vector<pair<Link*, double>>> linkShares;
+    for(auto group : workload->groups) {
+        for(auto conn : group->connections) {
+            paths.push_back(conn->path);
+            pathLinks.push_back(conn->pathLinks);
+            linkShares.push_back(conn->linkShares);
+        }
+    }
+    vector<vector<Connection>> treeRoutes;
+    for(auto group : workload->groups) {
+        treeRoutes.push_back(vector<Connection>());
+        for(auto conn : group->aggregation) {
+            treeRoutes.back().push_back(*conn);
+        }
+    }
+    vector<double> capacities;
+    for(auto link : topology->links) {
+        capacities.push_back(link->capacity);
+    }
+
+    auto build = [&]() {
+        Simulator* simulator = new Simulator();
+        simulator->workloads.push_back(workload);
+        simulator->topology = topology;
+        simulator->verbose = false;
+        simulator->faults = faults;
+        simulator->allocator = allocator;
+        return simulator;
+    };
+    Simulator* simulator = build();
+    if(faults.empty() || branchPoint == nullptr || !branchPoint->restore(simulator)) {
+        if(!simulator->tasks.empty()) {     // a failed restore
+            delete simulator;
+            simulator = build();
+        }
+        simulator->initialize();
+        simulator->start();
+    }
+    if(faults.empty() && branchPoint == nullptr) {  // the baseline, up to the first fault of any scenario
+        double first = numeric_limits<double>::infinity();
+        for(auto& scenario : scenarios) {
+            if(!scenario.empty()) first = min(first, scenario[0].time);
+        }
+        if(first > 0 && first < numeric_limits<double>::infinity() && simulator->advance(first)) {
+            branchPoint = new Checkpoint();
+            if(!branchPoint->capture(simulator)) {
+                delete branchPoint;
+                branchPoint = nullptr;
+            }
+        }
+    }
+    simulator->advance(numeric_limits<double>::infinity());
+    simulator->finish();
+    double time = simulator->globalTime;
+    rerouted = simulator->reroutedConnections;
+    migrated = simulator->migratedFlows;
+    finished = simulator->finished();
+    set<Group*> rebuilt = simulator->rebuiltTrees;
+    delete simulator;
+
+    int i = 0;
+    for(auto group : workload->groups) {
+        for(auto conn : group->connections) {
+            conn->path = paths[i];
+            conn->pathLinks = pathLinks[i];
+            conn->linkShares = linkShares[i];
+            i++;
+        }
+    }
+    for(int g = 0; g < workload->groups.size(); ++g) {
+        Group* group = workload->groups[g];
+        if(rebuilt.count(group) == 0) continue;
+        for(auto conn : group->aggregation) {
+            delete conn;
+        }
+        group->aggregation.clear();
+        for(auto& conn : treeRoutes[g]) {
+            group->aggregation.push_back(new Connection(conn));
+        }
+    }
+    for(auto link : topology->links) {
+        link->capacity = capacities[link->id];
+        link->failed = false;
+    }
+    topology->routingReady = false;
+    return time;
+}
+
+void FaultStudy::run(){
+    int rerouted, migrated;
+    bool finished;
+    vector<LinkFault> none;
+    delete branchPoint;
+    branchPoint = nullptr;
+    double baseline = simulate(none, rerouted, migrated, finished);
+    cout << "Baseline iteration time: " << baseline << endl;
+    if(branchPoint != nullptr) cout << "Scenarios continue from the baseline at time " << branchPoint->time << endl;
+    for(int i = 0; i < scenarios.size(); ++i) {
+        double time = simulate(scenarios[i], rerouted, migrated, finished);
+        cout << "Scenario " << names[i] << ": ";
+        if(finished) {
+            cout << "iteration time " << time;
+            cout << " (" << (baseline > 0 ? (time / baseline - 1) * 100 : 0) << "%)";
+        }
+        else {
+            cout << "stalled at " << time << " (disconnected ranks)";
+        }
+        cout << ", rerouted connections " << rerouted << ", migrated flows " << migrated << endl;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef FAULT_H
+#define FAULT_H
+
+#include "topology.h"
+#include "workload.h"
+#include "simulator.h"
+#include "allocator.h"
+#include "checkpoint.h"
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+// Runs a workload under link fault schedules and reports the iteration time
+// against a fault-free baseline. The baseline is checkpointed at the first
+// fault of any scenario and the scenarios go on from there.
+class FaultStudy {
+public:
+    Topology* topology;
+    Workload* workload;
+    vector<string> names;
+    vector<vector<LinkFault>> scenarios;
+    Allocator* allocator;   // bandwidth sharing for every run, max-min when null
+    Checkpoint* branchPoint;    // baseline state at the first fault, null before or if it cannot be taken
+
+    FaultStudy(Topology* topology, Workload* workload) : topology(topology), workload(workload), allocator(nullptr), branchPoint(nullptr) {}
+    ~FaultStudy() { delete allocator; delete branchPoint; }
+
+    bool load(const string& path);
+    double simulate(vector<LinkFault>& faults, int& rerouted, int& migrated, bool& finished);
+    void run();
+};
+
+#endif // FAULT_H
@@ -0,0 +1,309 @@
+#include "jitter.h"
+#include "common.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <cmath>
+
+using namespace std;
+
+
+bool JitterDistribution::parse(istringstream& ss){
+    string name;
+    if(!(ss >> name)) return false;
+    values.clear();
+    cumulative.clear();
+    if(name == "fixed") {
+        kind = FIXED;
+        return ss >> value && value > 0;
+    }
+    if(name == "lognormal") {
+        kind = LOGNORMAL;
+        return ss >> sigma && sigma >= 0;
+    }
+    if(name != "histogram") return false;
+    kind = HISTOGRAM;
+    string bin;
+    double total = 0;
+    while(ss >> bin) {
+        size_t colon = bin.find(':');
+        if(colon == string::npos) return false;
+        double v = atof(bin.substr(0, colon).c_str());
+        double weight = atof(bin.substr(colon + 1).c_str());
+        if(v <= 0 || weight < 0) return false;
+        total += weight;
+        values.push_back(v);
+        cumulative.push_back(total);
+    }
+    return total > 0;
+}
+
+double JitterDistribution::draw(mt19937& rng){
+    switch(kind) {
+        case LOGNORMAL:
+            return sigma > 0 ? lognormal_distribution<double>(-sigma * sigma / 2, sigma)(rng) : 1;
+        case HISTOGRAM: {
+            double u = uniform_real_distribution<double>(0, cumulative.back())(rng);
+            int bin = upper_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin();
+            return values[min(bin, (int)values.size() - 1)];
+        }
+        default:
+            return value;
+    }
+}
+
+// forward|backward|compute [<stage>] <distribution>
+// slow <rank id> <factor>
+// stragglers <probability> <factor>
+// seed <n>
+bool ComputeJitter::load(const string& path, Workload* workload){
+    ifstream in(path);
+    if(!in.is_open()) {
+        cerr << "Cannot open jitter model " << path << endl;
+        return false;
+    }
+    string line;
+    int lineNo = 0;
+    while(getline(in, line)) {
+        lineNo++;
+        line = line.substr(0, line.find('#'));
+        istringstream ss(line);
+        string kind;
+        if(!(ss >> kind)) continue;
+        bool valid = true;
+        if(kind == "forward" || kind == "backward" || kind == "compute") {
+            int stage = -1;
+            string word;
+            streampos start = ss.tellg();
+            if(ss >> word && isdigit(word[0])) {
+                stage = atoi(word.c_str());
+                if(stage >= workload->PP) valid = false;
+            }
+            else {
+                ss.clear();
+                ss.seekg(start);
+            }
+            JitterDistribution distribution;
+            valid = valid && distribution.parse(ss);
+            if(valid && kind != "backward") {
+                if(stage < 0) forward = distribution;
+                else stageForward[stage] = distribution;
+            }
+            if(valid && kind != "forward") {
+                if(stage < 0) backward = distribution;
+                else stageBackward[stage] = distribution;
+            }
+        }
+        else if(kind == "slow") {
+            int rank;
+            double factor;
+            valid = ss >> rank >> factor && rank >= 0 && rank < workload->ranks.size() && factor > 0;
+            if(valid) slowRanks[rank] = factor;
+        }
+        else if(kind == "stragglers") {
+            valid = ss >> stragglerProbability >> stragglerFactor && stragglerProbability >= 0 &&
+                    stragglerProbability <= 1 && stragglerFactor > 0;
+        }
+        else if(kind == "seed") {
+            valid = (bool)(ss >> seed);
+        }
+        else valid = false;
+        if(!valid) {
+            cerr << "Invalid jitter record at " << path << ":" << lineNo << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void ComputeJitter::begin(int sample, int ranks){
+    seed_seq sequence{seed, (unsigned)sample};
+    rng.seed(sequence);
+    slowdown.assign(ranks, 1.0);
+    stragglers = 0;
+    uniform_real_distribution<double> uniform(0, 1);
+    for(int r = 0; r < ranks; ++r) {
+        if(stragglerProbability > 0 && uniform(rng) < stragglerProbability) {
+            slowdown[r] = stragglerFactor;
+            stragglers++;
+        }
+    }
+    for(auto& slow : slowRanks) {
+        if(slow.first >= ranks) continue;
+        if(slowdown[slow.first] == 1.0) stragglers++;
+        slowdown[slow.first] *= slow.second;
+    }
+}
+
+double ComputeJitter::computeTime(Rank* rank, int microbatch, double time){
+    map<int, JitterDistribution>& stages = microbatch > 0 ? stageForward : stageBackward;
+    auto it = stages.find(rank->pp);
+    JitterDistribution& distribution = it != stages.end() ? it->second : microbatch > 0 ? forward : backward;
+    double factor = distribution.draw(rng);
+    if(rank->id < slowdown.size()) factor *= slowdown[rank->id];
+    return time * factor;
+}
+
+
+// The replica is routed with its own generator; taking the original's
+// paths keeps the network side of every sample identical to it.
+static void copyRoutes(Workload* from, Workload* to){
+    Topology* topology = to->topology;
+    for(int g = 0; g < from->groups.size() && g < to->groups.size(); ++g) {
+        Group* source = from->groups[g];
+        Group* target = to->groups[g];
+        for(int c = 0; c < source->connections.size() && c < target->connections.size(); ++c) {
+            Connection* conn = source->connections[c];
+            bool physical = true;   // pseudo-links belong to their own topology
+            for(auto link : conn->pathLinks) {
+                if(link->id < 0) physical = false;
+            }
+            if(!physical) continue;
+            Connection* copy = target->connections[c];
+            copy->path.clear();
+            copy->pathLinks.clear();
+            copy->linkShares.clear();
+            for(auto node : conn->path) {
+                copy->path.push_back(topology->nodes[node->id]);
+            }
+            for(auto link : conn->pathLinks) {
+                copy->pathLinks.push_back(topology->links[link->id]);
+            }
+            for(auto share : conn->linkShares) {
+                copy->linkShares.push_back(make_pair(topology->links[share.first->id], share.second));
+            }
+        }
+    }
+}
+
+static Workload* routedReplica(Workload* workload, Topology* replica, mt19937& rng){
+    Workload* job = workload->replicate(replica);
+    replica->rng = &rng;
+    job->routing();
+    copyRoutes(workload, job);
+    return job;
+}
+
+static double simulate(Topology* topology, Workload* workload){
+    Simulator* simulator = new Simulator();
+    simulator->workloads.push_back(workload);
+    simulator->topology = topology;
+    simulator->verbose = false;
+    simulator->initialize();
+    simulator->run();
+    double time = simulator->globalTime;
+    delete simulator;
+    return time;
+}
+
+void JitterStudy::worker(){
+    Topology* replica = topology->clone();
+    mt19937 routingRng;
+    Workload* job = routedReplica(workload, replica, routingRng);
+    ComputeJitter jitter = *model;
+
+    Simulator* simulator = new Simulator();
+    simulator->workloads.push_back(job);
+    simulator->topology = replica;
+    simulator->verbose = false;
+    simulator->jitter = &jitter;
+    simulator->initialize();
+    bool fresh = true;
+    while(true) {
+        int sample = nextSample++;
+        if(sample >= samples) break;
+        if(!fresh) simulator->reset();     // tasks, routes and links are kept
+        fresh = false;
+        jitter.begin(sample, job->ranks.size());
+        simulator->run();
+
+        vector<double> durations;
+        double previous = job->arrivalTime;
+        for(auto end : job->iterationEnds) {
+            durations.push_back(end - previous);
+            previous = end;
+        }
+        lock_guard<mutex> guard(lock);
+        iterations[sample] = durations;
+        times[sample] = simulator->globalTime;
+        stragglers[sample] = jitter.stragglers;
+    }
+    delete simulator;
+    delete job;
+    delete replica;
+}
+
+bool JitterStudy::run(){
+    double time = simulate(topology, workload);
+    deterministic = workload->iterationEnds.empty() ? 0 : (time - workload->arrivalTime) / workload->iterationEnds.size();
+
+    // samples are only comparable to the original if a replica without
+    // jitter runs exactly like it
+    Topology* replica = topology->clone();
+    mt19937 routingRng;
+    Workload* job = routedReplica(workload, replica, routingRng);
+    double replicaTime = simulate(replica, job);
+    delete job;
+    delete replica;
+    if(replicaTime != time) {
+        cerr << "Replica runs in " << replicaTime << " against " << time << " for the original workload" << endl;
+        return false;
+    }
+
+    iterations.assign(samples, vector<double>());
+    times.assign(samples, 0);
+    stragglers.assign(samples, 0);
+    nextSample = 0;
+    vector<thread> workers;
+    for(int t = 0; t < max(1, threads); ++t) {
+        workers.push_back(thread(&JitterStudy::worker, this));
+    }
+    for(auto& t : workers) {
+        t.join();
+    }
+    return true;
+}
+
+void JitterStudy::print(){
+    auto summary = [](vector<double> values) {
+        sort(values.begin(), values.end());
+        auto percentile = [&](double p) {   // nearest rank
+            int index = (int)ceil(p / 100 * values.size()) - 1;
+            return values[max(0, min((int)values.size() - 1, index))];
+        };
+        double mean = 0;
+        for(auto v : values) mean += v;
+        mean /= values.size();
+        cout << "mean " << mean << ", p50 " << percentile(50) << ", p90 " << percentile(90)
+             << ", p99 " << percentile(99) << ", p99.9 " << percentile(99.9) << ", max " << values.back() << endl;
+    };
+    vector<double> all;
+    int slowSamples = 0;
+    for(int s = 0; s < samples; ++s) {
+        all.insert(all.end(), iterations[s].begin(), iterations[s].end());
+        if(stragglers[s] > 0) slowSamples++;
+    }
+    cout << "Jitter study: " << samples << " samples, " << max(1, threads) << " threads, seed " << model->seed
+         << ", " << slowSamples << " samples with slow ranks" << endl;
+    cout << "Iteration time without jitter: " << deterministic << endl;
+    if(all.empty()) return;
+    cout << "Iteration time: ";
+    summary(all);
+    cout << "Job time: ";
+    summary(times);
+
+    vector<int> order(samples);
+    for(int s = 0; s < samples; ++s) order[s] = s;
+    sort(order.begin(), order.end(), [&](int a, int b) { return make_pair(-times[a], a) < make_pair(-times[b], b); });
+    cout << "Slowest samples:" << endl;
+    for(int i = 0; i < min(samples, 5); ++i) {
+        int s = order[i];
+        cout << "  sample " << s << ": " << times[s];
+        if(deterministic > 0 && !iterations[s].empty()) {
+            cout << " (" << (times[s] - workload->arrivalTime) / iterations[s].size() / deterministic << "x)";
+        }
+        cout << ", " << stragglers[s] << " slow ranks" << endl;
+    }
+}
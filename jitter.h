@@ -0,0 +1,81 @@
+#ifndef JITTER_H
+#define JITTER_H
+
+#include "topology.h"
+#include "workload.h"
+#include "simulator.h"
+
+#include <vector>
+#include <map>
+#include <string>
+#include <random>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+
+using namespace std;
+
+// Multiplier of a profiled compute time
+class JitterDistribution {
+public:
+    enum Kind {FIXED, LOGNORMAL, HISTOGRAM} kind = FIXED;
+    double value = 1;               // FIXED
+    double sigma = 0;               // LOGNORMAL, of the underlying normal; mean 1
+    vector<double> values;          // HISTOGRAM multipliers
+    vector<double> cumulative;      // and their cumulative weights
+
+    bool parse(istringstream& ss);  // fixed <v> | lognormal <sigma> | histogram <v>:<weight> ...
+    double draw(mt19937& rng);
+};
+
+// Random compute times of 1F1B ranks: every forward and backward is its
+// profiled time times a draw from the op's distribution, per stage if
+// given, times the rank's slowdown. Slow ranks are fixed or drawn per
+// sample. One generator per sample makes each sample reproducible.
+class ComputeJitter {
+public:
+    JitterDistribution forward, backward;
+    map<int, JitterDistribution> stageForward, stageBackward;  // by stage, over the above
+    map<int, double> slowRanks;     // rank id -> slowdown in every sample
+    double stragglerProbability = 0;    // per rank and sample
+    double stragglerFactor = 1;
+    unsigned seed = 0;
+
+    bool load(const string& path, Workload* workload);
+    void begin(int sample, int ranks);  // seeds the draws and picks the sample's stragglers
+    double computeTime(Rank* rank, int microbatch, double time);
+
+    mt19937 rng;
+    vector<double> slowdown;        // rank id -> this sample's factor
+    int stragglers = 0;             // slow ranks in this sample
+};
+
+// Batched Monte Carlo over compute jitter. Each worker thread routes a
+// replica of the topology and workload like the original, builds its
+// tasks once and resets them between samples; sample i always uses the
+// i-th generator seed, so results do not depend on the thread count.
+class JitterStudy {
+public:
+    Topology* topology;
+    Workload* workload;     // 1F1B workload, replicated per thread
+    ComputeJitter* model;
+    int samples;
+    int threads;
+
+    JitterStudy(Topology* topology, Workload* workload, ComputeJitter* model, int samples, int threads) :
+        topology(topology), workload(workload), model(model), samples(samples), threads(threads) {}
+
+    double deterministic = 0;       // iteration time without jitter
+    vector<vector<double>> iterations;  // per sample, duration of each iteration
+    vector<double> times;           // per sample, end of the last iteration
+    vector<int> stragglers;         // per sample
+
+    void worker();
+    bool run();     // false if a replica without jitter does not run like the original
+    void print();
+
+    atomic<int> nextSample;
+    mutex lock;         // guards the shared results
+};
+
+#endif // JITTER_H
@@ -1,8 +1,26 @@
 #include "topology.h"
 #include "workload.h"
 #include "simulator.h"
+#include "balancer.h"
+#include "trace.h"
+#include "cluster.h"
+#include "fault.h"
+#include "ecmp.h"
+#include "jitter.h"
+#include "allocator.h"
+#include "congestion.h"
+#include "packet.h"
+#include "critical.h"
+#include "utilization.h"
+#include "planner.h"
+#include "analytical.h"
+#include "distributed.h"
+#include "checkpoint.h"
 #include <chrono>
+#include <thread>
+#include <string>
 #include <iostream>
+#include <limits>
 
 using namespace std;
 
@@ -21,8 +39,14 @@ int main(int argc, char** argv){
     cout << "--------------------------" << endl;
     topology = new Topology();
     // topology->generateFattree(8, 1, 1);
+    // topology->generateOversubscribedClos(64, 16, 3.0, 1.0, 400e9/8, 800e9/8, 800e9/8); // radix, pods, TOR/AGG oversubscription, tier speeds
     // topology->generateOneBigSwitch(8, 1); // capacity * factor
+    // topology->generateRailOptimized(128, 8, 32, 2, 16, 200e9/8, 400e9/8); // servers, GPUs/server, servers/rail group, planes, spines/plane
+    // topology->addServerFabric(900e9/2, 64e9);  // NVSwitch per server (per-GPU NVLink), NIC behind PCIe; assignServers(8) first for Clos hosts
     topology->generateOneBigSwitch(16*8*8, 400.0*1000000000/8); // capacity * factor
+    // topology->setLatency(1e-6, 0.5e-6);  // seconds per link: host/NIC links, switch-to-switch links
+    // topology->aggregationThroughput = 1.6e12; topology->maxAggregationTrees = 4;  // switch reduction bytes/s, trees at once
+    // topology->multipath = SPRAY; topology->multipathWidth = 0;  // split over all (0) or k equal-cost paths, ADAPTIVE: least-loaded
     // topology->print();
     auto current = chrono::high_resolution_clock::now();
     cout << "Topology generation Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
@@ -41,40 +65,181 @@ int main(int argc, char** argv){
     //                         11796480,    // bwdPPSize
     //                         5121446400     // dpSize
     //                     );
-    workload = new Workload(2,      // PP
-                            2,      // DP      
-                            2,      // TP 
-                            5,      // microbatches   
-                            0.1,    // fwdCompTime * factor
-                            0.1,    // bwdCompTime * factor
-                            1.0,    // fwdTPSize
-                            1.0,    // bwdTPSize
-                            1.0,    // fwdPPSize
-                            1.0,    // bwdPPSize
-                            1.0     // dpSize
-                        );
+    if(argc > 2 && string(argv[1]) == "jobs") {        // ./simulator jobs <file>
+        ClusterScenario scenario(topology);
+        if(!scenario.load(argv[2])) return 1;
+        scenario.run();
+        current = chrono::high_resolution_clock::now();
+        cout << "Multi-job simulation Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
+        return 0;
+    }
+    if(argc > 3 && string(argv[1]) == "plan") {        // ./simulator plan <model> <globalBatch> [threads]
+        int threads = argc > 4 ? atoi(argv[4]) : thread::hardware_concurrency();
+        ParallelismPlanner planner(topology, atoi(argv[3]), threads);
+        // planner.memoryCapacity = 80e9; planner.modes = {STORE_ACTIVATIONS, RECOMPUTE, OFFLOAD};
+        if(!planner.loadModel(argv[2]) || planner.globalBatch <= 0) return 1;
+        planner.run();
+        planner.print();
+        current = chrono::high_resolution_clock::now();
+        cout << "Parallelism planning Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
+        return 0;
+    }
+    if(argc > 2 && string(argv[1]) == "trace") {       // ./simulator trace <file>
+        TraceReader* reader = new TraceReader();
+        if(!reader->open(argv[2])) return 1;
+        workload = reader->buildWorkload();
+    }
+    else {
+        workload = new Workload(2,      // PP
+                                2,      // DP      
+                                2,      // TP 
+                                5,      // microbatches   
+                                0.1,    // fwdCompTime * factor
+                                0.1,    // bwdCompTime * factor
+                                1.0,    // fwdTPSize
+                                1.0,    // bwdTPSize
+                                1.0,    // fwdPPSize
+                                1.0,    // bwdPPSize
+                                1.0     // dpSize
+                            );
+    }
     workload->topology = topology;
-    workload->configureParallelism();   // 1F1B now
+    // workload->railAligned = true;   // rail-optimized topologies
+    // workload->launchOverhead = 10e-6; workload->stepOverhead = 2e-6; workload->chunkSize = 1 << 20;  // alpha-beta latency
+    // workload->inNetworkAggregation = true;   // DP all-reduce reduced in the switches (SHARP-style)
+    // workload->activationMode = RECOMPUTE; workload->memoryCapacity = 80e9;   // or OFFLOAD over PCIe; memory from the profile
+    if(argc > 2 && string(argv[1]) == "profile") {     // ./simulator profile <file>
+        if(!workload->loadProfile(argv[2])) return 1;
+    }
+    if(argc > 2 && string(argv[1]) == "balance") {     // ./simulator balance <file>
+        StageBalancer balancer(topology, workload->PP, workload->DP, workload->TP, workload->microbatches);
+        if(!balancer.loadLayers(argv[2])) return 1;
+        vector<int> partition = balancer.balance();
+        balancer.print(partition);
+        current = chrono::high_resolution_clock::now();
+        cout << "Stage balancing Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
+        return 0;
+    }
+    if(workload->trace == nullptr) {
+        workload->configureParallelism();   // 1F1B now
+    }
     workload->placement();
     workload->routing();
+    if(!workload->fitsMemory()) {
+        cerr << "Configuration does not fit in " << workload->memoryCapacity / 1e9 << " GB per GPU:";
+        for(int pp = 0; pp < workload->PP; ++pp) cerr << " " << workload->peakMemory(pp) / 1e9;
+        cerr << " GB per stage" << endl;
+        return 1;
+    }
     // workload->print();
     // return 0;
+    if(argc > 2 && string(argv[1]) == "faults") {      // ./simulator faults <file>
+        FaultStudy study(topology, workload);
+        if(!study.load(argv[2])) return 1;
+        study.run();
+        current = chrono::high_resolution_clock::now();
+        cout << "Fault study Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
+        return 0;
+    }
+    if(argc > 2 && string(argv[1]) == "ecmp") {        // ./simulator ecmp <seeds> [threads]
+        int threads = argc > 3 ? atoi(argv[3]) : thread::hardware_concurrency();
+        EcmpStudy study(topology, workload, atoi(argv[2]), threads);
+        if(study.seeds <= 0 || workload->trace != nullptr) {
+            cerr << "ECMP study needs a positive seed count and a 1F1B workload" << endl;
+            return 1;
+        }
+        study.run();
+        study.print();
+        current = chrono::high_resolution_clock::now();
+        cout << "ECMP study Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
+        return 0;
+    }
+    if(argc > 3 && string(argv[1]) == "jitter") {      // ./simulator jitter <model> <samples> [threads]
+        int threads = argc > 4 ? atoi(argv[4]) : thread::hardware_concurrency();
+        ComputeJitter model;
+        if(!model.load(argv[2], workload)) return 1;
+        JitterStudy study(topology, workload, &model, atoi(argv[3]), threads);
+        if(study.samples <= 0 || workload->trace != nullptr) {
+            cerr << "Jitter study needs a positive sample count and a 1F1B workload" << endl;
+            return 1;
+        }
+        if(!study.run()) return 1;
+        study.print();
+        current = chrono::high_resolution_clock::now();
+        cout << "Jitter study Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
+        return 0;
+    }
+    if(argc > 2 && string(argv[1]) == "distributed") { // ./simulator distributed <processes> [threads]: forked, over loopback
+        double time = runDistributed(topology, workload, atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 1);
+        current = chrono::high_resolution_clock::now();
+        cout << "Distributed simulation Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
+        return time < 0 ? 1 : 0;
+    }
+    if(argc > 5 && string(argv[1]) == "partition") {   // ./simulator partition <index> <processes> <host of 0> <port> [threads]
+        Transport transport(atoi(argv[2]), atoi(argv[3]));
+        if(transport.index < 0 || transport.index >= transport.processes || transport.processes > workload->PP) return 1;
+        if(transport.index == 0 ? !transport.listen(atoi(argv[5])) || !transport.accept() : !transport.connect(argv[4], atoi(argv[5]))) return 1;
+        runPartition(topology, workload, &transport, argc > 6 ? atoi(argv[6]) : 1, transport.index == 0);
+        return 0;
+    }
+    if(argc > 2 && string(argv[1]) == "scaling") {     // ./simulator scaling <max processes> [threads]
+        scalingBenchmark(topology, workload, atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 1);
+        return 0;
+    }
+    AnalyticalEstimator* estimator = nullptr;
+    if(argc > 1 && string(argv[1]) == "estimate") {    // ./simulator estimate: closed form, then checked by simulation
+        estimator = new AnalyticalEstimator(workload);
+        auto begin = chrono::high_resolution_clock::now();
+        if(estimator->estimate() < 0) {
+            cerr << "The analytical estimate needs a 1F1B workload" << endl;
+            return 1;
+        }
+        current = chrono::high_resolution_clock::now();
+        estimator->print();
+        cout << "Analytical estimate Execution Time: " << chrono::duration_cast<chrono::microseconds>(current - begin).count() << " us" << endl;
+    }
     current = chrono::high_resolution_clock::now();
     cout << "Workload generation Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
     start = current;
     cout << "--------------------------" << endl;
     simulator = new Simulator();
-    simulator->workload = workload;
+    simulator->workloads.push_back(workload);
     simulator->topology = topology;
-    simulator->initialize();
+    // simulator->allocator = makeAllocator("priority PP TP DP");  // maxmin | weighted | priority | propfair
+    // simulator->congestion = new CongestionControl();   // DCQCN-like rate dynamics while flows start and finish
+    // simulator->packets = new PacketDomain(); simulator->packets->autoSelect = 4;  // hot links simulated per packet
+    // simulator->critical = new CriticalPath();  // critical path breakdown and bottleneck links after the run
+    // simulator->monitor = new UtilizationMonitor(topology, "utilization.bin");  // rank/link utilization report, binary series
+    // simulator->threads = thread::hardware_concurrency();  // parallel max-min and stable time, bit-identical results
+    Checkpoint checkpoint;
+    bool resume = argc > 2 && string(argv[1]) == "resume";     // ./simulator resume <file>: from a checkpoint to the end
+    if(resume) {
+        if(!checkpoint.load(argv[2]) || !checkpoint.restore(simulator)) return 1;
+    }
+    else simulator->initialize();
     // simulator->print();    
     current = chrono::high_resolution_clock::now();
     cout << "Simulator initialization Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
     start = current;
     cout << "--------------------------" << endl;
-    simulator->run();
+    if(argc > 3 && string(argv[1]) == "checkpoint") {  // ./simulator checkpoint <time> <file>: saved on the way
+        simulator->start();
+        if(simulator->advance(atof(argv[2]))) {
+            if(!checkpoint.capture(simulator) || !checkpoint.save(argv[3])) return 1;
+            cout << "Checkpoint at time " << checkpoint.time << " saved to " << argv[3] << endl;
+        }
+        simulator->advance(numeric_limits<double>::infinity());
+        simulator->finish();
+    }
+    else if(resume) {
+        cout << "Resumed at time " << checkpoint.time << endl;
+        simulator->advance(numeric_limits<double>::infinity());
+        simulator->finish();
+    }
+    else simulator->run();
     current = chrono::high_resolution_clock::now();
     cout << "Simulator run Execution Time: " << chrono::duration_cast<chrono::milliseconds>(current - start).count() << " ms" << endl;
+    if(estimator != nullptr) estimator->print(simulator->globalTime);
     cout << "--------------------------" << endl;
 
     return 0;
@@ -0,0 +1,248 @@
+#include "packet.h"
+#include "common.h"
+
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+
+PacketDomain::~PacketDomain(){
+    for(auto packetLink : links) {
+        delete packetLink;
+    }
+}
+
+void PacketDomain::select(Link* link){
+    if(linkIndex.count(link)) return;
+    PacketLink* packetLink = new PacketLink(link);
+    links.push_back(packetLink);
+    linkIndex[link] = packetLink;
+}
+
+void PacketDomain::allocate(vector<Flow*>& active, Allocator* fallback){
+    // packet links do not share their capacity in the flow-level
+    // allocation, they only hold each flow to its line rate, what its
+    // path allows it alone; the packet simulation does the sharing
+    vector<double> capacities;
+    for(auto packetLink : links) {
+        capacities.push_back(packetLink->link->capacity);
+    }
+    vector<double> lineRate(active.size(), numeric_limits<double>::infinity());
+    for(int f = 0; f < active.size(); ++f) {
+        for(auto share : active[f]->linkShares) {
+            lineRate[f] = min(lineRate[f], share.first->capacity / share.second);
+        }
+    }
+    for(auto packetLink : links) {
+        packetLink->link->capacity = 0;
+    }
+    for(int f = 0; f < active.size(); ++f) {
+        if(!isfinite(lineRate[f])) continue;
+        for(auto share : active[f]->linkShares) {
+            if(linkIndex.count(share.first)) share.first->capacity += lineRate[f] * share.second;
+        }
+    }
+    fallback->allocate(active);
+    for(int f = 0; f < active.size(); ++f) {
+        active[f]->throughput = min(active[f]->throughput, lineRate[f]);
+    }
+    for(int i = 0; i < links.size(); ++i) {
+        links[i]->link->capacity = capacities[i];
+    }
+
+    // saturated links shared by many flows join the packet domain from the next step
+    if(links.size() < autoSelect) {
+        vector<Link*> candidates;
+        for(auto flow : active) {
+            for(auto share : flow->linkShares) {
+                Link* link = share.first;
+                if(linkIndex.count(link) || link->flows.size() < incastFanIn) continue;
+                if(link->throughput >= link->capacity * (1 - 1e-9)) candidates.push_back(link);
+            }
+        }
+        for(auto link : candidates) {
+            if(links.size() < autoSelect) select(link);
+        }
+    }
+
+    // offer the flow-level rates to the packet links
+    flows.clear();
+    offered.clear();
+    for(auto packetLink : links) {
+        packetLink->arrival = 0;
+    }
+    vector<pair<Flow*, double>> previous;
+    for(auto packetLink : links) {
+        map<Flow*, double> next;
+        for(int i = 0; i < packetLink->flows.size(); ++i) {
+            next[packetLink->flows[i]] = packetLink->nextArrival[i];
+        }
+        packetLink->flows.clear();
+        packetLink->rate.clear();
+        packetLink->nextArrival.clear();
+        for(auto flow : active) {
+            if(!isfinite(flow->throughput) || flow->throughput <= 0) continue;
+            for(auto share : flow->linkShares) {
+                if(share.first != packetLink->link) continue;
+                double rate = flow->throughput * share.second;
+                auto it = next.find(flow);
+                // spread the first packets of new flows over one packet time
+                double phase = fmod(packetLink->flows.size() * 0.6180339887, 1.0) * mtu / rate;
+                packetLink->nextArrival.push_back(it != next.end() ? it->second : now + phase);
+                packetLink->flows.push_back(flow);
+                packetLink->rate.push_back(rate);
+                packetLink->arrival += rate;
+            }
+        }
+        packetLink->index.clear();
+        for(int i = 0; i < packetLink->flows.size(); ++i) {
+            packetLink->index[packetLink->flows[i]] = i;
+        }
+        packetLink->deliveredBytes.assign(packetLink->flows.size(), 0);
+        // packets of finished flows leave the queue
+        deque<pair<Flow*, double>> kept;
+        packetLink->queueBytes = 0;
+        for(auto packet : packetLink->queue) {
+            if(packetLink->index.count(packet.first)) {
+                kept.push_back(packet);
+                packetLink->queueBytes += packet.second;
+            }
+        }
+        if(kept.size() != packetLink->queue.size()) {
+            packetLink->queue.swap(kept);
+            packetLink->busyUntil = now + (packetLink->queue.empty() ? 0 : packetLink->queue.front().second / packetLink->link->capacity);
+        }
+        packetLink->busy = packetLink->arrival > packetLink->link->capacity * (1 + 1e-9) || !packetLink->queue.empty();
+    }
+    busy = false;
+    for(auto packetLink : links) {
+        if(packetLink->busy) busy = true;
+    }
+
+    // expected throughput until the packet links report what they delivered
+    for(auto flow : active) {
+        if(!isfinite(flow->throughput) || flow->throughput <= 0) continue;
+        double factor = 1;
+        bool crosses = false;
+        for(auto share : flow->linkShares) {
+            auto it = linkIndex.find(share.first);
+            if(it == linkIndex.end()) continue;
+            crosses = true;
+            PacketLink* packetLink = it->second;
+            if(packetLink->busy) factor = min(factor, packetLink->link->capacity / packetLink->arrival);
+        }
+        if(!crosses) continue;
+        flows.push_back(flow);
+        offered.push_back(flow->throughput);
+        flow->throughput *= factor;
+    }
+    for(auto packetLink : links) {
+        packetLink->link->throughput = min(packetLink->arrival, packetLink->link->capacity);
+    }
+}
+
+double PacketDomain::stableTime(){
+    return busy ? window : numeric_limits<double>::infinity();
+}
+
+void PacketDomain::simulate(PacketLink* pl, double end){
+    double capacity = pl->link->capacity;
+    typedef pair<double, int> Arrival;  // time, flow
+    priority_queue<Arrival, vector<Arrival>, greater<Arrival>> arrivals;
+    auto schedule = [&](double from) {
+        arrivals = priority_queue<Arrival, vector<Arrival>, greater<Arrival>>();
+        for(int i = 0; i < pl->flows.size(); ++i) {
+            pl->nextArrival[i] = max(pl->nextArrival[i], from);
+            arrivals.push(make_pair(pl->nextArrival[i], i));
+        }
+    };
+    schedule(now);
+    double pausedSince = now;
+    double inf = numeric_limits<double>::infinity();
+    while(true) {
+        double departure = pl->queue.empty() ? inf : pl->busyUntil;
+        double arrival = !pl->paused && !arrivals.empty() ? arrivals.top().first : inf;
+        double t = min(departure, arrival);
+        if(t > end) break;
+        if(departure <= arrival) {
+            pair<Flow*, double> packet = pl->queue.front();
+            pl->queue.pop_front();
+            pl->queueBytes -= packet.second;
+            pl->deliveredBytes[pl->index[packet.first]] += packet.second;
+            pl->delivered += packet.second;
+            if(!pl->queue.empty()) pl->busyUntil = t + pl->queue.front().second / capacity;
+            if(pl->paused && pl->queueBytes <= xon) {
+                pl->paused = false;
+                pl->pausedTime += t - pausedSince;
+                schedule(t);
+            }
+            continue;
+        }
+        int i = arrivals.top().second;
+        arrivals.pop();
+        if(!pfc && pl->queueBytes + mtu > buffer) {
+            pl->dropped += mtu;
+            pl->nextArrival[i] = t + mtu / pl->rate[i] + retransmitDelay;
+        }
+        else {
+            if(pl->queue.empty()) pl->busyUntil = t + mtu / capacity;
+            pl->queue.push_back(make_pair(pl->flows[i], mtu));
+            pl->queueBytes += mtu;
+            pl->maxQueue = max(pl->maxQueue, pl->queueBytes);
+            pl->nextArrival[i] = t + mtu / pl->rate[i];
+            if(pfc && pl->queueBytes >= xoff) {
+                pl->paused = true;
+                pausedSince = t;
+            }
+        }
+        arrivals.push(make_pair(pl->nextArrival[i], i));
+    }
+    if(pl->paused) pl->pausedTime += end - pausedSince;
+}
+
+void PacketDomain::progress(double time){
+    if(time <= 0 || flows.empty()) {
+        now += time;
+        return;
+    }
+    double end = now + time;
+    for(auto packetLink : links) {
+        fill(packetLink->deliveredBytes.begin(), packetLink->deliveredBytes.end(), 0);
+        if(packetLink->busy) {
+            simulate(packetLink, end);
+            continue;
+        }
+        for(int i = 0; i < packetLink->flows.size(); ++i) {    // passes through
+            packetLink->deliveredBytes[i] = packetLink->rate[i] * time;
+            packetLink->delivered += packetLink->deliveredBytes[i];
+        }
+    }
+    // a flow gets what its most restrictive packet link delivered
+    for(int f = 0; f < flows.size(); ++f) {
+        Flow* flow = flows[f];
+        double rate = offered[f];
+        for(auto share : flow->linkShares) {
+            auto it = linkIndex.find(share.first);
+            if(it == linkIndex.end()) continue;
+            PacketLink* packetLink = it->second;
+            double bytes = packetLink->deliveredBytes[packetLink->index[flow]];
+            rate = min(rate, bytes / share.second / time);
+        }
+        flow->throughput = rate;
+    }
+    now = end;
+}
+
+void PacketDomain::print(){
+    cout << "Packet-level links (" << (pfc ? "PFC" : "tail drop") << "):" << endl;
+    for(auto packetLink : links) {
+        Link* link = packetLink->link;
+        cout << "  Link " << link->id << " (" << link->src->id << " -> " << link->dst->id << ")";
+        cout << ": delivered " << packetLink->delivered << " B, dropped " << packetLink->dropped << " B";
+        cout << ", max queue " << packetLink->maxQueue << " B, paused " << packetLink->pausedTime << " s" << endl;
+    }
+}
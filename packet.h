@@ -0,0 +1,79 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "simulator.h"
+#include "topology.h"
+#include "allocator.h"
+
+#include <vector>
+#include <deque>
+#include <map>
+
+using namespace std;
+
+// One link simulated packet by packet: a FIFO output queue with a finite
+// buffer, served at the link capacity. Flows inject MTU packets at the rate
+// the flow-level domain gives them.
+class PacketLink {
+public:
+    Link* link;
+    PacketLink(Link* link) : link(link), queueBytes(0), busyUntil(0), paused(false),
+        delivered(0), dropped(0), pausedTime(0), maxQueue(0) {}
+
+    deque<pair<Flow*, double>> queue;   // < flow, bytes >
+    double queueBytes;
+    double busyUntil;                   // departure of the head packet
+    bool paused;                        // PFC XOFF sent upstream
+
+    // flows offered to the link in this step, in allocation order
+    vector<Flow*> flows;
+    vector<double> rate;                // injection rate into this link
+    vector<double> nextArrival;         // next packet of each flow
+    vector<double> deliveredBytes;      // in the current step
+    map<Flow*, int> index;
+    double arrival;                     // total offered rate
+    bool busy;                          // overloaded or queueing: simulate per packet
+
+    // totals
+    double delivered, dropped, pausedTime, maxQueue;
+};
+
+// Hybrid packet/flow simulation. The selected links, and optionally the
+// links found saturated by many flows, leave the flow-level allocation:
+// flows get the rates the rest of the fabric allows, these are offered to
+// the packet-level links, and what the links deliver in each step becomes
+// the flows' throughput for that step. Only links that are overloaded or
+// still queueing are simulated per packet; the others pass traffic through.
+class PacketDomain {
+public:
+    double mtu;
+    double buffer;          // bytes per output queue
+    bool pfc;               // lossless: pause senders above xoff, resume below xon; otherwise tail drop
+    double xoff, xon;
+    double retransmitDelay; // tail drop: a sender stalls this long after a loss
+    double window;          // longest step while packet links are busy
+    int autoSelect;         // most links added when found saturated, 0: only the selected ones
+    int incastFanIn;        // flows on a saturated link that make it a candidate
+
+    PacketDomain() : mtu(4096), buffer(1 << 20), pfc(true), xoff(0.75 * (1 << 20)), xon(0.5 * (1 << 20)),
+        retransmitDelay(0), window(50e-6), autoSelect(0), incastFanIn(4), now(0), busy(false) {}
+    ~PacketDomain();
+
+    vector<PacketLink*> links;
+    map<Link*, PacketLink*> linkIndex;
+    void select(Link* link);
+
+    double now;
+    bool busy;              // some packet link overloaded or queueing
+    vector<Flow*> flows;    // flows crossing packet links in this step
+    vector<double> offered; // their rates from the flow-level domain
+
+    void allocate(vector<Flow*>& active, Allocator* fallback);
+    double stableTime();
+    void progress(double time);         // simulates the packet links and sets delivered throughputs
+    void simulate(PacketLink* packetLink, double end);
+
+    void print();
+};
+
+#endif // PACKET_H
@@ -0,0 +1,70 @@
+#include "parallel.h"
+
+#include <algorithm>
+
+using namespace std;
+
+
+WorkerPool::WorkerPool(int threads) : threads(max(1, threads)), grain(2048){
+    for(int t = 1; t < this->threads; ++t) {
+        workers.push_back(thread(&WorkerPool::loop, this, t));
+    }
+}
+
+WorkerPool::~WorkerPool(){
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int WorkerPool::chunks(int n){
+    return max(1, min(threads, n / grain));
+}
+
+void WorkerPool::runChunk(int chunk){
+    int begin = (long long)items * chunk / parts;
+    int end = (long long)items * (chunk + 1) / parts;
+    (*job)(begin, end, chunk);
+}
+
+void WorkerPool::run(int n, const function<void(int, int, int)>& work){
+    int count = chunks(n);
+    if(count == 1) {
+        work(0, n, 0);
+        return;
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        job = &work;
+        items = n;
+        parts = count;
+        pending = count - 1;
+        generation++;
+    }
+    wake.notify_all();
+    runChunk(0);
+    unique_lock<mutex> guard(lock);
+    idle.wait(guard, [this]() { return pending == 0; });
+    job = nullptr;
+}
+
+void WorkerPool::loop(int chunk){
+    int seen = 0;
+    while(true) {
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [&]() { return stopping || generation != seen; });
+            if(stopping) return;
+            seen = generation;
+            if(chunk >= parts) continue;    // a short loop, not every thread takes part
+        }
+        runChunk(chunk);
+        lock_guard<mutex> guard(lock);
+        if(--pending == 0) idle.notify_one();
+    }
+}
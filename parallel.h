@@ -0,0 +1,43 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+// Persistent threads running one data-parallel loop at a time. [0, n) is
+// cut into one contiguous chunk per thread, the same cut for the same n, so
+// a reduction combined in chunk order does not depend on the scheduling.
+// The calling thread runs chunk 0; run() returns once every chunk is done.
+class WorkerPool {
+public:
+    int threads;
+    int grain;      // loops with fewer items per thread run inline, a hand-off costs more than they do
+
+    WorkerPool(int threads);
+    ~WorkerPool();
+
+    // work(begin, end, chunk); chunks() tells how many run() will make for n
+    void run(int n, const function<void(int, int, int)>& work);
+    int chunks(int n);
+
+private:
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, idle;
+    const function<void(int, int, int)>* job = nullptr;
+    int items = 0;
+    int parts = 0;
+    int generation = 0;
+    int pending = 0;
+    bool stopping = false;
+
+    void loop(int chunk);
+    void runChunk(int chunk);
+};
+
+#endif // PARALLEL_H
@@ -0,0 +1,207 @@
+#include "planner.h"
+#include "common.h"
+
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <random>
+#include <limits>
+
+using namespace std;
+
+
+bool ParallelismPlanner::loadModel(const string& path){
+    StageBalancer reader(topology, 1, 1, 1, 1);
+    if(!reader.loadLayers(path)) return false;
+    layers = reader.layers;
+    return true;
+}
+
+// Workload of a candidate on the given topology, stage tables filled and
+// the 1F1B order configured; not placed or routed.
+Workload* ParallelismPlanner::build(PlanCandidate& candidate, Topology* topology){
+    StageBalancer balancer(topology, candidate.PP, candidate.DP, candidate.TP, candidate.microbatches);
+    double b = candidate.microbatchSize;
+    int t = candidate.TP;
+    for(auto layer : layers) {
+        layer.fwdCompTime *= b / t;
+        layer.bwdCompTime *= b / t;
+        layer.fwdTPSize *= b;
+        layer.bwdTPSize *= b;
+        layer.activationSize *= b;
+        layer.paramSize /= t;
+        balancer.layers.push_back(layer);
+    }
+    if(candidate.partition.empty()) candidate.partition = balancer.initialPartition();
+
+    Workload* workload = new Workload(candidate.PP, candidate.DP, candidate.TP, candidate.microbatches, 0, 0, 0, 0, 0, 0, 0);
+    balancer.applyPartition(workload, candidate.partition);
+    int begin = 0;
+    for(int s = 0; s < candidate.PP; ++s) {
+        double activation = 0;
+        for(int l = begin; l < begin + candidate.partition[s]; ++l) {
+            activation += balancer.layers[l].activationSize;
+        }
+        begin += candidate.partition[s];
+        workload->stageActivationMemory[s] = activationFactor * activation / t;
+        workload->stageStaticMemory[s] = stateFactor * workload->stageDPSize[s];
+    }
+    workload->activationMode = candidate.mode;
+    workload->memoryCapacity = memoryCapacity;
+    workload->topology = topology;
+    workload->configureParallelism();
+    return workload;
+}
+
+// No faster than the busiest stage: the first forward has to reach it, it
+// computes and runs TP for every microbatch back to back, and then either
+// its own DP all-reduce or the last backward down to stage 0 and stage 0's
+// all-reduce follow. Transfers go at most at the fastest host link, with
+// no latency.
+double ParallelismPlanner::lowerBound(Workload* workload){
+    int PP = workload->PP;
+    double tpFactor = 2.0 * (workload->TP - 1) / workload->TP / hostBandwidth;
+    double dpFactor = 2.0 * (workload->DP - 1) / workload->DP / hostBandwidth;
+    double bound = 0;
+    double fwdChain = 0, bwdChain = 0;
+    for(int s = 0; s < PP; ++s) {
+        double fwd = workload->getCompTime(s, 1) + workload->getTPSize(s, 1) * tpFactor;
+        double bwd = workload->getCompTime(s, -1) + workload->getTPSize(s, -1) * tpFactor;
+        if(s > 0) bwdChain += workload->getPPSize(s, -1) / hostBandwidth;
+        double stage = fwdChain + workload->microbatches * (fwd + bwd);
+        stage += max(workload->getDPSize(s) * dpFactor, bwdChain + workload->getDPSize(0) * dpFactor);
+        bound = max(bound, stage);
+        fwdChain += fwd + (s < PP - 1 ? workload->getPPSize(s, 1) / hostBandwidth : 0);
+        bwdChain += bwd;
+    }
+    return bound;
+}
+
+void ParallelismPlanner::enumerate(){
+    int gpus = 0;
+    hostBandwidth = 0;
+    for(auto node : topology->nodes) {
+        if(node->type != HOST) continue;
+        gpus++;
+        for(auto link : node->links) {
+            hostBandwidth = max(hostBandwidth, link->capacity);
+        }
+    }
+    candidates.clear();
+    enumerated = rejectedMemory = 0;
+    for(int TP = 1; TP <= min(gpus, maxTP); ++TP) {
+        if(gpus % TP != 0) continue;
+        for(int PP = 1; PP <= min(gpus / TP, (int)layers.size()); ++PP) {
+            if(gpus / TP % PP != 0) continue;
+            int DP = gpus / TP / PP;
+            if(globalBatch % DP != 0) continue;
+            int replicaBatch = globalBatch / DP;
+            for(int microbatches = PP; microbatches <= replicaBatch; ++microbatches) {   // 1F1B fills the pipeline
+                if(replicaBatch % microbatches != 0) continue;
+                for(auto mode : modes) {
+                    PlanCandidate candidate;
+                    candidate.PP = PP;
+                    candidate.DP = DP;
+                    candidate.TP = TP;
+                    candidate.microbatches = microbatches;
+                    candidate.microbatchSize = (double)replicaBatch / microbatches;
+                    candidate.mode = mode;
+                    candidate.time = -1;
+                    enumerated++;
+                    Workload* workload = build(candidate, topology);
+                    candidate.memory = 0;
+                    for(int pp = 0; pp < PP; ++pp) {
+                        candidate.memory = max(candidate.memory, workload->peakMemory(pp));
+                    }
+                    bool fits = workload->fitsMemory();
+                    candidate.bound = lowerBound(workload);
+                    delete workload;
+                    if(!fits) {
+                        rejectedMemory++;
+                        continue;
+                    }
+                    candidates.push_back(candidate);
+                }
+            }
+        }
+    }
+    stable_sort(candidates.begin(), candidates.end(), [](const PlanCandidate& a, const PlanCandidate& b) {
+        return a.bound < b.bound;
+    });
+}
+
+// Candidates are taken in bound order; once the top list is full, one whose
+// bound is no better than its last entry cannot enter it, nor can any later
+// one. The top list does not depend on the thread count.
+void ParallelismPlanner::worker(){
+    Topology* replica = topology->clone();
+    mt19937 rng;
+    replica->rng = &rng;
+    while(true) {
+        int i = next++;
+        if(i >= candidates.size()) break;
+        PlanCandidate& candidate = candidates[i];
+        {
+            lock_guard<mutex> guard(lock);
+            if(best.size() >= top && candidate.bound >= best.back()) break;
+        }
+        rng.seed(0);    // same routing for every candidate
+        Workload* workload = build(candidate, replica);
+        workload->placement();
+        workload->routing();
+        Simulator* simulator = new Simulator();
+        simulator->workloads.push_back(workload);
+        simulator->topology = replica;
+        simulator->verbose = false;
+        simulator->initialize();
+        simulator->run();
+        double time = simulator->globalTime;
+        delete simulator;
+        delete workload;
+
+        lock_guard<mutex> guard(lock);
+        candidate.time = time;
+        simulated++;
+        best.insert(upper_bound(best.begin(), best.end(), time), time);
+        if(best.size() > top) best.pop_back();
+    }
+    delete replica;
+}
+
+void ParallelismPlanner::run(){
+    enumerate();
+    best.clear();
+    simulated = 0;
+    next = 0;
+    vector<thread> workers;
+    for(int t = 0; t < max(1, threads); ++t) {
+        workers.push_back(thread(&ParallelismPlanner::worker, this));
+    }
+    for(auto& t : workers) {
+        t.join();
+    }
+    pruned = candidates.size() - simulated;
+}
+
+void ParallelismPlanner::print(){
+    const char* modeNames[] = {"1F1B", "1F1B+recompute", "1F1B+offload"};
+    cout << "Parallelism plan: " << enumerated << " candidates, " << rejectedMemory << " over memory, "
+         << pruned << " pruned by bound, " << simulated << " simulated, " << max(1, threads) << " threads" << endl;
+    vector<PlanCandidate*> ranked;
+    for(auto& candidate : candidates) {
+        if(candidate.time >= 0) ranked.push_back(&candidate);
+    }
+    stable_sort(ranked.begin(), ranked.end(), [](PlanCandidate* a, PlanCandidate* b) {
+        return a->time < b->time;
+    });
+    for(int i = 0; i < min((int)ranked.size(), top); ++i) {
+        PlanCandidate* c = ranked[i];
+        cout << "  " << i + 1 << ". PP " << c->PP << " DP " << c->DP << " TP " << c->TP
+             << ", " << c->microbatches << " microbatches of " << c->microbatchSize << ", " << modeNames[c->mode]
+             << ": iteration " << c->time << " s (bound " << c->bound << "), "
+             << globalBatch / c->time << " samples/s, peak memory " << c->memory / 1e9 << " GB" << endl;
+        cout << "     stages:";
+        for(auto layers : c->partition) cout << " " << layers;
+        cout << " layers" << endl;
+    }
+}
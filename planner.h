@@ -0,0 +1,68 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include "topology.h"
+#include "workload.h"
+#include "simulator.h"
+#include "balancer.h"
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+class PlanCandidate {
+public:
+    int PP, DP, TP, microbatches;
+    ActivationMode mode;
+    double microbatchSize;      // samples
+    vector<int> partition;      // layers per stage
+    double bound;               // analytical lower bound on the iteration time
+    double memory;              // planned peak of the fullest stage
+    double time;                // simulated, < 0 while not simulated
+};
+
+// Searches PP x DP x TP x microbatches x activation mode for a model and a
+// global batch with the simulator as the cost model. Layer costs are given
+// per sample at TP 1 (the balancer's layer records): compute and DP sizes
+// are split by TP, compute, TP and PP sizes scale with the microbatch size.
+// Layers are cut into stages by balancing compute. Candidates that do not
+// fit in memory are dropped, the rest are simulated in order of their lower
+// bound, skipping those whose bound cannot beat the current top results.
+class ParallelismPlanner {
+public:
+    Topology* topology;
+    vector<LayerCost> layers;
+    int globalBatch;            // samples per iteration
+    int threads;
+    int maxTP;                  // largest TP degree, usually a server
+    int top;                    // ranked results kept
+    double memoryCapacity;      // per GPU, 0: unchecked
+    double activationFactor;    // stored activation bytes per byte of layer output
+    double stateFactor;         // weights + gradients + optimizer bytes per gradient byte
+    vector<ActivationMode> modes;
+
+    ParallelismPlanner(Topology* topology, int globalBatch, int threads) :
+        topology(topology), globalBatch(globalBatch), threads(threads), maxTP(8), top(10), memoryCapacity(80e9),
+        activationFactor(16), stateFactor(8), modes{STORE_ACTIVATIONS, RECOMPUTE} {}
+
+    bool loadModel(const string& path);
+    Workload* build(PlanCandidate& candidate, Topology* topology);
+    double lowerBound(Workload* workload);
+    void enumerate();
+    void worker();
+    void run();
+    void print();
+
+    vector<PlanCandidate> candidates;   // fitting ones, by bound
+    int enumerated, rejectedMemory, pruned, simulated;
+    double hostBandwidth;               // fastest link out of a host
+
+    vector<double> best;                // simulated times, ascending, at most top
+    atomic<int> next;
+    mutex lock;         // guards best and the results
+};
+
+#endif // PLANNER_H
@@ -1,39 +1,86 @@
 #include "common.h"
 #include "simulator.h"
+#include "allocator.h"
+#include "congestion.h"
+#include "packet.h"
+#include "critical.h"
+#include "utilization.h"
+#include "parallel.h"
+#include "distributed.h"
+#include "jitter.h"
 
 
 #include <limits>
 #include <vector>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
 
 
 using namespace std;
 
-extern Topology* topology;
-extern Workload* workload;
-
-
-Flow::Flow(Connection* connection){
+Flow::Flow(Connection* connection) : connection(connection) {
     src = connection->src->host;
     dst = connection->dst->host;
+    throughput = 0;
+    bottleneck = nullptr;
+    controlled = false;
+    rate = targetRate = alpha = 0;
+    route();
+}
+
+// Subflows of a multipath connection are kept as per-link shares of one
+// flow, so they get one throughput and finish together.
+void Flow::route(){
     path = connection->path;
     pathLinks = connection->pathLinks;
+    linkShares = connection->linkShares;
+    if(linkShares.empty()) {
+        for(auto link : pathLinks) {
+            linkShares.push_back(make_pair(link, 1.0));
+        }
+    }
 }
 
-Collective::Collective(Group* group, int microbatch, int accumulatedSize) : 
+bool Flow::disconnected(){
+    return src != dst && linkShares.empty();
+}
+
+Collective::Collective(Group* group, int microbatch, int accumulatedSize, double size) : 
         group(group), microbatch(microbatch), accumulatedSize(accumulatedSize) {    
     accumulatedInvocations = 1;
     // build flows     
     this->flows.clear();
-    if(group->type == GroupType::TP || group->type == GroupType::DP) { // all connections
+    aggregated = false;
+    activity = nullptr;
+    if(group->type == GroupType::DP && !group->aggregation.empty()) {   // take a tree if one is free
+        Topology* topology = group->workload->topology;
+        if(topology->maxAggregationTrees == 0 || topology->activeAggregationTrees < topology->maxAggregationTrees) {
+            aggregated = true;
+            topology->activeAggregationTrees++;
+            topology->aggregatedCollectives++;
+        }
+        else topology->aggregationFallbacks++;
+    }
+    if(aggregated) {    // each rank sends its data up once and gets the result back
+        for(auto connection : group->aggregation) {
+            Flow* flow = new Flow(connection);
+            flow->remainingSize = size >= 0 ? size : group->workload->getDPSize(group->pp);
+            this->flows.push_back(flow);
+            flow->collective = this;
+        }
+    }
+    else if(group->type == GroupType::TP || group->type == GroupType::DP) { // all connections
         for(auto connection : group->connections) {
             Flow* flow = new Flow(connection);
-            if(group->type == GroupType::TP) {
-                flow->remainingSize = microbatch > 0 ? workload->fwdTPSize : workload->bwdTPSize;
+            if(size >= 0) {
+                flow->remainingSize = size;
+            }
+            else if(group->type == GroupType::TP) {
+                flow->remainingSize = group->workload->getTPSize(group->pp, microbatch);
             }
             else{
-                flow->remainingSize = workload->dpSize;
+                flow->remainingSize = group->workload->getDPSize(group->pp);
             }            
             double factor = 2.0 * (group->ranks.size()-1) / group->ranks.size();
             flow->remainingSize *= factor;
@@ -43,10 +90,51 @@ Collective::Collective(Group* group, int microbatch, int accumulatedSize) :
     }
     else { // PP, generate one connection
         Flow* flow = new Flow(group->connections[0]);
-        flow->remainingSize = microbatch > 0 ? workload->fwdPPSize : workload->bwdPPSize;
+        flow->remainingSize = size >= 0 ? size : group->workload->getPPSize(group->pp, microbatch);
         this->flows.push_back(flow);
         flow->collective = this;
     }
+    remainingLatency = latency();
+}
+
+// Alpha part of the alpha-beta model in closed form: launch overhead plus,
+// for each algorithm step (2(n-1) for a ring all-reduce, 1 for a PP send or
+// a tree reduction), the slowest path's latency and the pipelining delay of
+// one chunk per extra hop. The beta part is the flows' bandwidth phase that
+// follows.
+double Collective::latency(){
+    Workload* workload = group->workload;
+    int n = group->ranks.size();
+    int steps = group->type == GroupType::PP || aggregated ? 1 : 2 * (n - 1);
+    double path = 0;
+    for(auto flow : flows) {
+        double delay = 0;
+        double hops = 0;
+        for(auto share : flow->linkShares) {
+            if(share.first->src == share.first->dst) continue;  // reduction engine
+            double weight = aggregated ? 1.0 : share.second;   // tree shares split data, not paths
+            delay += weight * share.first->latency;
+            hops += weight;
+        }
+        if(workload->chunkSize > 0 && hops > 1) {
+            double bottleneck = numeric_limits<double>::infinity();
+            for(auto share : flow->linkShares) {
+                bottleneck = min(bottleneck, share.first->capacity);
+            }
+            double stepSize = flow->remainingSize / steps;
+            delay += (hops - 1) * min(workload->chunkSize, stepSize) / bottleneck;
+        }
+        path = max(path, delay);
+    }
+    if(workload->launchOverhead == 0 && workload->stepOverhead == 0 && path == 0) return 0;
+    return workload->launchOverhead + steps * (workload->stepOverhead + path);
+}
+
+Collective::~Collective(){
+    if(aggregated) group->workload->topology->activeAggregationTrees--;
+    for(auto flow : flows) {
+        delete flow;
+    }
 }
 
 
@@ -65,10 +153,46 @@ GroupTask::GroupTask(Group* group) : group(group) {
     group->groupTask = this;
     this->group = group;
     activeCollective = nullptr;
+    invocationsPerCollective = group->type == GroupType::PP ? 1 : group->ranks.size();
     this->senders.clear();
     this->receivers.clear();
 }
 
+GroupTask::~GroupTask(){
+    reset();
+}
+
+void GroupTask::reset(){
+    delete activeCollective;
+    activeCollective = nullptr;
+    for(auto collective : waitingCollectives) {
+        delete collective;
+    }
+    waitingCollectives.clear();
+    for(auto it : accumulatingCollectives) {
+        delete it.second;
+    }
+    accumulatingCollectives.clear();
+    invocationSizes.clear();
+    events.clear();
+}
+
+void RankTask::reset(){
+    events.clear();
+    iteration = 0;
+    remainingTime = 0;
+    released = computing = nullptr;
+    fill(stateTime, stateTime + 6, 0.0);
+    stateSince = -1;
+    clock = rank->workload->arrivalTime;
+    activationMemory = peakMemory = 0;
+    memoryTimeline.clear();
+    offloading.clear();
+    offloaded.clear();
+    reloading.clear();
+    startIteration();
+}
+
 
 
 
@@ -217,6 +341,7 @@ void Simulator::printStates(){
 
 
 int RankTask::handleEvents(){   // < EP, TYPE, MB >
+    Workload* workload = rank->workload;
     int countEvents = events.size();
     for(auto it = events.begin(); it != events.end(); ) {
         int ep = get<0>(*it);
@@ -243,10 +368,11 @@ int RankTask::handleEvents(){   // < EP, TYPE, MB >
                 // transit to next MB; 
                 if(workload->nextMicrobatch.find(make_tuple(rank->pp, microbatch)) != workload->nextMicrobatch.end()){
                     microbatch = workload->nextMicrobatch[make_tuple(rank->pp, microbatch)];
-                    state = RankState::PP_WAIT;
+                    setState(RankState::PP_WAIT);
+                    if(microbatch < 0 && offloaded.count(-microbatch) && !reloading.count(-microbatch)) reload(-microbatch);
                 }
                 else {
-                    state = RankState::DP_WAIT;
+                    setState(RankState::DP_WAIT);
                 }
                 it = events.erase(it);
             }
@@ -259,8 +385,16 @@ int RankTask::handleEvents(){   // < EP, TYPE, MB >
             // RECV
             // transit to complete
             if(state == RankState::DP_COMM){
-                state = RankState::DONE;
-                it = events.erase(it); continue;
+                setState(RankState::DONE);
+                it = events.erase(it);
+                workload->rankFinished(iteration);
+                if(++iteration < workload->iterations) {
+                    int before = events.size();
+                    startIteration();
+                    countEvents += events.size() - before;
+                    it = events.begin();
+                }
+                continue;
             }
             else{
                 it++; continue;
@@ -272,7 +406,7 @@ int RankTask::handleEvents(){   // < EP, TYPE, MB >
                 // else ignore
                 if( mb == -workload->microbatches ) {
                     if(state == RankState::DP_WAIT) {
-                        state = RankState::DP_COMM;
+                        setState(RankState::DP_COMM);
                         dpGroupTask->events.push_back(make_tuple(rank->id, 0));
                         it = events.erase(it); continue;
                     }
@@ -286,9 +420,15 @@ int RankTask::handleEvents(){   // < EP, TYPE, MB >
             }
             else {  // RECV
                 // transit to compute
-                if(state == RankState::PP_WAIT && mb == microbatch){
-                    state = RankState::COMPUTE;
-                    remainingTime = microbatch > 0 ? workload->fwdCompTime : workload->bwdCompTime;
+                if(state == RankState::PP_WAIT && mb == microbatch && resident(-mb)){
+                    setState(RankState::COMPUTE);
+                    remainingTime = workload->getCompTime(rank->pp, microbatch);
+                    if(jitter != nullptr) remainingTime = jitter->computeTime(rank, microbatch, remainingTime);
+                    if(mb > 0) addMemory(workload->getStoredMemory(rank->pp, mb));
+                    else if(workload->activationMode == RECOMPUTE) {
+                        addMemory(workload->getActivationMemory(rank->pp, mb) - workload->getStoredMemory(rank->pp, mb));
+                    }
+                    if(critical != nullptr) critical->computeStarted(this);
                     it = events.erase(it); continue;
                 }
                 else{
@@ -308,12 +448,15 @@ int GroupTask::handleEvents(){  // < From, MB >
         int mb = get<1>(*it);    // 微批次
         // 检查是否有等待的集合操作
         if (accumulatingCollectives.find(mb) == accumulatingCollectives.end()) {
-            Collective* collective = new Collective(group, mb, group->type == GroupType::PP ? 1 : group->ranks.size());
+            auto sizeIt = invocationSizes.find(mb);
+            double size = sizeIt != invocationSizes.end() ? sizeIt->second : -1;
+            Collective* collective = new Collective(group, mb, invocationsPerCollective, size);
             accumulatingCollectives[mb] = collective;
         }
         else {
             accumulatingCollectives[mb]->accumulatedInvocations++;
         }
+        if(critical != nullptr) critical->invoked(accumulatingCollectives[mb], from);
         // 移除已处理的事件
         it = events.erase(it);
     }
@@ -323,7 +466,9 @@ int GroupTask::handleEvents(){  // < From, MB >
 
         // 如果集合操作已完成，移动到等待队列
         if (collective->accumulatedInvocations == collective->accumulatedSize) {
+            invocationSizes.erase(mb);
             waitingCollectives.push_back(collective);
+            if(critical != nullptr) critical->ready(collective);
             it = accumulatingCollectives.erase(it);
         }
         else {
@@ -334,6 +479,7 @@ int GroupTask::handleEvents(){  // < From, MB >
     if (activeCollective == nullptr && !waitingCollectives.empty()) {
         activeCollective = waitingCollectives.front();
         waitingCollectives.erase(waitingCollectives.begin());
+        if(critical != nullptr) critical->started(activeCollective);
     }
     return countEvents - events.size();
 }
@@ -344,8 +490,11 @@ double Flow::stableTime(){
 }
 
 double Collective::stableTime(){
+    if(remainingLatency > 0) return remainingLatency;
+    if(done()) return 0;    // nothing to send, e.g. a TP group of one
     double time = numeric_limits<double>::infinity();
     for(auto flow : flows){
+        if(flow->remainingSize <= 0) continue;   // finished ahead of the others
         double t = flow->stableTime();
         if(t < time) time = t;
     }
@@ -376,15 +525,29 @@ double RankTask::stableTime(){
 }
 
 void Flow::progress(double time){
-    if(remainingSize<1e-6) {
+    if(throughput == numeric_limits<double>::infinity()) {
         remainingSize = 0;
     }
     else{
         remainingSize -= throughput * time;
+        if(remainingSize <= throughput * TIME_RESOLUTION) remainingSize = 0;  // ends in this round
     }
 }
 
+bool Collective::done(){
+    if(remainingLatency > 0) return false;
+    for(auto flow : flows) {
+        if(flow->remainingSize > 0) return false;
+    }
+    return true;
+}
+
 void Collective::progress(double time){
+    if(remainingLatency > 0) {
+        remainingLatency -= time;
+        if(remainingLatency <= TIME_RESOLUTION) remainingLatency = 0;
+        return;
+    }
     for(auto flow : flows){
         flow->progress(time);
     }
@@ -396,23 +559,23 @@ void GroupTask::progress(double time){
         if(!waitingCollectives.empty()) {
             activeCollective = waitingCollectives.front();
             waitingCollectives.erase(waitingCollectives.begin());
+            if(critical != nullptr) critical->started(activeCollective);
         }
     }
     if(activeCollective == nullptr) 
         return ;
 
     activeCollective->progress(time);
-    if(activeCollective->flows[0]->remainingSize <= 1e-6 ) {   // EP TYPE MB
+    if(activeCollective->done()) {   // EP TYPE MB
+        if(critical != nullptr) critical->finished(activeCollective, this);
         // notify senders
-        tuple<int, int, int> event = make_tuple(EndpointType::SENT, group->type, activeCollective->microbatch);
         for(auto rankTask : senders){
-            rankTask->events.push_back(event);
+            rankTask->notify(EndpointType::SENT, this, activeCollective->microbatch);
         }
 
         // notify receivers
-        tuple<int, int, int> event2 = make_tuple(EndpointType::RECV, group->type, activeCollective->microbatch);
         for(auto task: receivers){
-            task->events.push_back(event2);
+            task->notify(EndpointType::RECV, this, activeCollective->microbatch);
         }
 
         delete activeCollective;  
@@ -420,19 +583,102 @@ void GroupTask::progress(double time){
         if(!waitingCollectives.empty()) {
             activeCollective = waitingCollectives.front();
             waitingCollectives.erase(waitingCollectives.begin());
+            if(critical != nullptr) critical->started(activeCollective);
         }
     }
 
 }
 
 
+void RankTask::startIteration(){
+    Workload* workload = rank->workload;
+    microbatch = 1;
+    setState(RankState::PP_WAIT);
+
+    // prepare notifications,
+    // all stage 0 (PP)    
+    // all stage  -1  (PP)
+    // stage 0 (DP)
+    if(rank->pp == 0) { // add all forward events
+        for(int i = 1; i <= workload->microbatches; i++){
+            events.push_back(make_tuple(EndpointType::RECV, GroupType::PP, i));
+        }
+    }
+    if(rank->pp == workload->PP - 1) { // add all backward events
+        for(int i = 1; i <= workload->microbatches; i++){
+            events.push_back(make_tuple(EndpointType::RECV, GroupType::PP, -i));
+        }
+    }
+    if(rank->pp == 0){ // stage 0 sends no backward PP, unblock its DP directly
+        events.push_back(make_tuple(EndpointType::SENT, GroupType::PP, -workload->microbatches));
+    }
+}
+
+void RankTask::setState(RankState next){
+    if(monitor != nullptr && next != state) {
+        stateTime[state] += monitor->now - stateSince;
+        stateSince = monitor->now;
+    }
+    state = next;
+}
+
+void RankTask::notify(int endpoint, GroupTask* groupTask, int microbatch){
+    if(groupTask == offloadGroupTask || groupTask == reloadGroupTask) {   // copies within the rank
+        if(endpoint != EndpointType::RECV) return;
+        if(groupTask == reloadGroupTask) {
+            reloading.erase(microbatch);
+            offloaded.erase(microbatch);
+            return;
+        }
+        addMemory(-rank->workload->getActivationMemory(rank->pp, microbatch));
+        offloading.erase(microbatch);
+        offloaded.insert(microbatch);
+        if(this->microbatch == -microbatch) reload(microbatch);    // its backward is already next
+        return;
+    }
+    events.push_back(make_tuple(endpoint, groupTask->group->type, microbatch));
+}
+
+void RankTask::addMemory(double bytes){
+    if(bytes == 0) return;
+    activationMemory += bytes;
+    peakMemory = max(peakMemory, activationMemory);
+    memoryTimeline.push_back(make_pair(clock, activationMemory));
+}
+
+void RankTask::offload(int microbatch){
+    offloadGroupTask->invocationSizes[microbatch] = rank->workload->getActivationMemory(rank->pp, microbatch);
+    offloadGroupTask->events.push_back(make_tuple(rank->id, microbatch));
+    offloading.insert(microbatch);
+}
+
+// Room for the activations is taken back when the copy starts.
+void RankTask::reload(int microbatch){
+    addMemory(rank->workload->getActivationMemory(rank->pp, microbatch));
+    reloadGroupTask->invocationSizes[microbatch] = rank->workload->getActivationMemory(rank->pp, microbatch);
+    reloadGroupTask->events.push_back(make_tuple(rank->id, microbatch));
+    reloading.insert(microbatch);
+}
+
+bool RankTask::resident(int microbatch){
+    return microbatch <= 0 || (!offloading.count(microbatch) && !offloaded.count(microbatch));
+}
+
 void RankTask::progress(double time){
+    clock += time;
     switch(state) {
         case COMPUTE:
             remainingTime -= time;
-            if(remainingTime <= 1e-6) {
-                state = TP_COMM;
+            if(remainingTime <= TIME_RESOLUTION) {
+                setState(RankState::TP_COMM);
                 remainingTime = 0;
+                if(critical != nullptr) critical->computeFinished(this);
+                Workload* workload = rank->workload;
+                if(microbatch < 0) addMemory(-workload->getActivationMemory(rank->pp, microbatch));
+                else if(offloadGroupTask != nullptr) {
+                    auto next = workload->nextMicrobatch.find(make_tuple(rank->pp, microbatch));
+                    if(next != workload->nextMicrobatch.end() && next->second != -microbatch) offload(microbatch);
+                }
                 tpGroupTask->events.push_back(make_tuple(rank->id, microbatch));
             }
             break;
@@ -442,20 +688,63 @@ void RankTask::progress(double time){
 }
 
 void Simulator::initialize(){
+    admitted.assign(workloads.size(), false);
+    for(int i = 0; i < workloads.size(); ++i) {
+        if(workloads[i]->arrivalTime <= 0) {
+            initializeWorkload(workloads[i]);
+            admitted[i] = true;
+        }
+    }
+}
+
+// Repeated runs of the same workloads, e.g. Monte Carlo samples, skip
+// building the tasks again.
+void Simulator::reset(){
+    for(auto task : tasks) {
+        GroupTask* groupTask = dynamic_cast<GroupTask*>(task);
+        if(groupTask != nullptr) groupTask->reset();
+        else dynamic_cast<RankTask*>(task)->reset();
+    }
+    for(auto link : topology->links) {
+        link->flows.clear();
+        link->load = 0;
+    }
+    for(auto workload : workloads) {
+        workload->finishedRanks.clear();
+        workload->iterationEnds.clear();
+    }
+    globalTime = 0;
+    rounds = 0;
+    nextFault = 0;
+    reroutedConnections = 0;
+    migratedFlows = 0;
+}
+
+void Simulator::initializeWorkload(Workload* workload){
+    workload->finishedRanks.clear();
+    workload->iterationEnds.clear();
+    if(workload->trace != nullptr) {
+        initializeTrace(workload);
+        return;
+    }
 
     // create tasks, 
     for(auto group : workload->groups) {
+        if(partition != nullptr && !partition->owns(group)) continue;
         GroupTask* task = new GroupTask(group);
         tasks.push_back(task);
     }
     for(auto rank : workload->ranks) {
+        if(partition != nullptr && !partition->owns(rank)) continue;
         RankTask* task = new RankTask(rank);
         task->microbatch = 1;
+        task->clock = workload->arrivalTime;
         tasks.push_back(task);
     }
 
     // associate tasks;
     for(auto rank : workload->ranks) {
+        if(partition != nullptr && !partition->owns(rank)) continue;
         RankTask* task = rank->rankTask;
         GroupTask* tpGroupTask = rank->tpGroup->groupTask;
         GroupTask* dpGroupTask = rank->dpGroup->groupTask;
@@ -468,7 +757,8 @@ void Simulator::initialize(){
         dpGroupTask->receivers.push_back(task);
 
         if(rank->ppFwdGroup != nullptr){            
-            RankTask* fwdReceiverTask = rank->ppFwdGroup->ranks[1]->rankTask;
+            Rank* receiver = rank->ppFwdGroup->ranks[1];
+            RankTask* fwdReceiverTask = partition == nullptr || partition->owns(receiver) ? receiver->rankTask : partition->boundaryTask(receiver);
             GroupTask* ppFwdGroupTask = rank->ppFwdGroup->groupTask;               
             task->ppFwdGroupTask = ppFwdGroupTask;
             ppFwdGroupTask->senders.push_back(task);
@@ -476,150 +766,134 @@ void Simulator::initialize(){
         }
 
         if(rank->ppBwdGroup != nullptr){
-            RankTask* bwdReceiverTask = rank->ppBwdGroup->ranks[1]->rankTask;
+            Rank* receiver = rank->ppBwdGroup->ranks[1];
+            RankTask* bwdReceiverTask = partition == nullptr || partition->owns(receiver) ? receiver->rankTask : partition->boundaryTask(receiver);
             GroupTask* ppBwdGroupTask = rank->ppBwdGroup->groupTask; 
             task->ppBwdGroupTask = ppBwdGroupTask;
             ppBwdGroupTask->senders.push_back(task);
             ppBwdGroupTask->receivers.push_back(bwdReceiverTask);
         }
-    }
 
-    // init rank microbatch
-    for(auto rankTask : tasks) {
-        if(dynamic_cast<RankTask*>(rankTask) != nullptr) {
-            RankTask* task = dynamic_cast<RankTask*>(rankTask);
-            task->microbatch = 1;
-            task->state = RankState::PP_WAIT;
+        if(rank->offloadGroup != nullptr) {
+            task->offloadGroupTask = rank->offloadGroup->groupTask;
+            task->reloadGroupTask = rank->reloadGroup->groupTask;
+            for(auto groupTask : {task->offloadGroupTask, task->reloadGroupTask}) {
+                groupTask->senders.push_back(task);
+                groupTask->receivers.push_back(task);
+            }
         }
     }
 
-    // prepare notifications,
-    // all stage 0 (PP)    
-    // all stage  -1  (PP)
-    // stage 0 (DP)
+    // init rank microbatch and notifications
     for(auto rank : workload->ranks) {
-        if(rank->pp == 0) { // add all forward events
-            RankTask* task = rank->rankTask;
-            for(int i = 1; i <= workload->microbatches; i++){
-                tuple<int, int, int> event = make_tuple(EndpointType::RECV, GroupType::PP, i);
-                task->events.push_back(event);
-            }
-        }
-        if(rank->pp == workload->PP - 1) { // add all backward events
-            RankTask* task = rank->rankTask;
-            for(int i = 1; i <= workload->microbatches; i++){
-                tuple<int, int, int> event = make_tuple(EndpointType::RECV, GroupType::PP, -i);
-                task->events.push_back(event);
-            }
-        }
-        if(rank->pp == workload->PP - 1){
-            RankTask* task = rank->rankTask;
-            tuple<int, int, int> event = make_tuple(EndpointType::SENT, GroupType::PP, -workload->microbatches);
-            task->events.push_back(event);
-        }
+        if(partition != nullptr && !partition->owns(rank)) continue;
+        rank->rankTask->iteration = 0;
+        rank->rankTask->startIteration();
     }
 }
 
 void Simulator::updateStates(){
     // collective active flows
-    set<Flow*> activeFlows;
+    vector<Flow*> activeFlows;
     for(auto task : tasks){
 
         if(dynamic_cast<GroupTask*>(task) != nullptr) {
             GroupTask* groupTask = dynamic_cast<GroupTask*>(task);
-            if(groupTask->activeCollective != nullptr) {
+            if(groupTask->activeCollective != nullptr && groupTask->activeCollective->remainingLatency <= 0) {
                 for(auto flow : groupTask->activeCollective->flows) {
-                    activeFlows.insert(flow);
+                    activeFlows.push_back(flow);
                 }
             }
         }
     }
-    // update flow throughput
-    for(auto flow : activeFlows){
-        flow->throughput = 0;
-    }
-
-    // collective active links
-    set<Link*> activeLinks;
-    for(auto flow : activeFlows){
-        for(auto link : flow->pathLinks){
-            activeLinks.insert(link);
+    // adaptive multipath: place flows one by one on the least-loaded paths
+    if(topology->multipath == ADAPTIVE) {
+        vector<double> load(topology->links.size(), 0);
+        for(auto flow : activeFlows) {
+            if(flow->src == flow->dst || flow->pathLinks.empty()) continue;
+            flow->linkShares = topology->spray(flow->src, flow->dst, topology->multipathWidth, &load);
+            for(auto share : flow->linkShares) {
+                load[share.first->id] += share.second;
+            }
         }
     }
 
-    // update link throughput
-    for(auto link : activeLinks){
-        link->throughput = 0;
-        link->flows.clear();
+    static MaxMinAllocator maxMin;
+    Allocator* sharing = allocator != nullptr ? allocator : &maxMin;
+    if(allocator == nullptr && parallelMaxMin != nullptr && packets == nullptr) sharing = parallelMaxMin;  // packets read link->flows
+    if(partition != nullptr) partition->allocate(activeFlows);   // max-min with the other processes' flows
+    else if(congestion != nullptr) congestion->allocate(activeFlows, sharing);
+    else if(packets != nullptr) packets->allocate(activeFlows, sharing);
+    else sharing->allocate(activeFlows);
+    for(auto flow : activeFlows) {
+        if(flow->disconnected()) flow->throughput = 0;   // allocators give path-less flows infinite rates
     }
+    if(critical != nullptr) critical->allocated(activeFlows);
+    if(monitor != nullptr) monitor->allocated(activeFlows);
+}
 
-    // update link flows
-    for(auto flow : activeFlows){
-        for(auto link : flow->pathLinks){
-            link->flows.insert(flow);
-        }
+Simulator::~Simulator(){
+    for(auto task : tasks) {
+        delete task;
     }
+    delete parallelMaxMin;  // left by a run that did not finish
+    delete pool;
+}
 
-    // update throughput
-    while(!activeFlows.empty() && !activeLinks.empty()) { // water filling
-        // iterate links to get minimum throughput
-        double minAug = numeric_limits<double>::infinity();
-        for(auto link : activeLinks) {
-            double aug = (link->capacity - link->throughput)/link->flows.size();
-            if(aug < minAug) {
-                minAug = aug;
-            }
-        }
-        // update flows 
-        for(auto flow : activeFlows) {
-            flow->throughput += minAug;
-        }
-        // update links
-        for(auto link : activeLinks) {
-            link->throughput += minAug * link->flows.size();
-        } 
-        // freeze link
-        set<Link*> frozenLinks;
-        for(auto link : activeLinks) {
-            if(link->throughput >= link->capacity - 1e-6) {
-                frozenLinks.insert(link);
-            }
-        }
-        // freeze flows
-        set<Flow*> frozenFlows;
-        for(auto link : frozenLinks) {
-            for(auto flow : link->flows) {
-                frozenFlows.insert(flow);
-            }
-        }
-        // freeze flows in the same collective 
-        for(auto flow : frozenFlows) {
-            for(auto other : flow->collective->flows) {
-                if(other != flow) {
-                    frozenFlows.insert(other);
-                }
-            }
-        }
-        // remove frozen flows
-        for(auto flow : frozenFlows) {
-            activeFlows.erase(flow);
-        }
-        // remove frozen links
-        for(auto link : frozenLinks) {
-            activeLinks.erase(link);
+// Rounds are the synchronization: no task changes before the smallest
+// stable time, so the tasks are searched in parallel, one contiguous block
+// per thread, and the blocks' minima combined in order.
+double Simulator::stableTime(){
+    if(pool == nullptr) {
+        double time = numeric_limits<double>::infinity();
+        for(auto task : tasks){
+            double t = task->stableTime();
+            if(t < time) time = t;
         }
+        return time;
     }
-
-    // if active flows is not empty, it is internal, it completes immediately
-    for(auto flow : activeFlows) {
-        flow->throughput = numeric_limits<double>::infinity();
-        // flow->remainingSize = 0;
+    vector<double> partial(pool->chunks(tasks.size()), numeric_limits<double>::infinity());
+    pool->run(tasks.size(), [&](int begin, int end, int chunk) {
+        double time = numeric_limits<double>::infinity();
+        for(int i = begin; i < end; ++i) {
+            double t = tasks[i]->stableTime();
+            if(t < time) time = t;
+        }
+        partial[chunk] = time;
+    });
+    double time = numeric_limits<double>::infinity();
+    for(auto t : partial) {
+        if(t < time) time = t;
     }
+    return time;
 }
 
 void Simulator::run(){
+    start();
+    advance(numeric_limits<double>::infinity());
+    finish();
+}
+
+void Simulator::start(){
     globalTime=0;
-    cout << "===========================" << endl;
+    rounds = 0;
+    nextFault = 0;
+    if(threads > 1 && pool == nullptr) {
+        pool = new WorkerPool(threads);
+        parallelMaxMin = new ParallelMaxMinAllocator(pool);
+    }
+    for(auto task : tasks) {
+        task->critical = critical;
+        RankTask* rankTask = dynamic_cast<RankTask*>(task);
+        if(rankTask != nullptr) rankTask->jitter = jitter;
+    }
+    if(monitor != nullptr) monitor->attach(tasks);
+    if(verbose) cout << "===========================" << endl;
+}
+
+// The round that reaches `until` is cut there, as for a link fault, and
+// the next call goes on with the following round.
+bool Simulator::advance(double until){
     int round = 0;
     int targetRound = -1;    
     while(true){
@@ -628,6 +902,10 @@ void Simulator::run(){
         // cout << "----------------------------" << endl;
         // cout << " before handle events" << endl;
         if(round==targetRound) printStates(); // !!!!!!!!!!!!!!
+        admitWorkloads();
+        while(nextFault < faults.size() && faults[nextFault].time <= globalTime + TIME_RESOLUTION) {
+            applyFault(faults[nextFault++]);
+        }
 
         while(1){
             int countEvents = 0;
@@ -636,25 +914,56 @@ void Simulator::run(){
             }
             if(countEvents == 0) break;
         }
+        recordIterations();
         // cout << " after handle events, before update states" << endl;
         if(round==targetRound) printStates(); // !!!!!!!!!!!!!!
         // update states
         updateStates();
+        while(partition != nullptr && partition->delivered > 0) {   // PP arrivals from the other processes
+            int countEvents = 0;
+            for(auto task : tasks){
+                countEvents += task->handleEvents();
+            }
+            if(countEvents == 0) break;
+        }
         // cout << "----------------------------" << endl;
         // cout << " after update states " << endl;
         if(round==targetRound) printStates(); // !!!!!!!!!!!!!!!
         // stable time
-        double time = numeric_limits<double>::infinity();
-        for(auto task : tasks){
-            double t = task->stableTime();
-            if(t < time) time = t;
-        }
+        double time = stableTime();
         // cout << "----------------------------" << endl;
+        // next job arrival
+        for(int i = 0; i < workloads.size(); ++i) {
+            if(!admitted[i] && workloads[i]->arrivalTime - globalTime < time) {
+                time = workloads[i]->arrivalTime - globalTime;
+            }
+        }
+        // congestion control step during transients
+        if(congestion != nullptr && congestion->stableTime() < time) {
+            time = congestion->stableTime();
+        }
+        // refresh packet-level rates while packet links are busy
+        if(packets != nullptr && packets->stableTime() < time) {
+            time = packets->stableTime();
+        }
+        // next link fault
+        if(nextFault < faults.size() && faults[nextFault].time - globalTime < time) {
+            time = max(0.0, faults[nextFault].time - globalTime);
+        }
+        if(partition != nullptr) time = partition->stableTime(time);
         // cout << "Stable time: " << time << endl;
         if(time == numeric_limits<double>::infinity()){
-            break;
+            return false;
         }
+        // a congestion control transient integrates over whole steps, so
+        // its round ends past `until` rather than being cut
+        bool cut = until - globalTime < time;
+        if(cut && (congestion == nullptr || congestion->stable)) time = max(0.0, until - globalTime);
         // progress
+        if(congestion != nullptr) congestion->progress(time);   // before finished flows are deleted
+        if(packets != nullptr) packets->progress(time);
+        if(critical != nullptr) critical->progress(time);   // clock of the task transitions below
+        if(monitor != nullptr) monitor->progress(time);
         for(auto task : tasks){
             task->progress(time);
         }
@@ -665,8 +974,105 @@ void Simulator::run(){
         if(round==targetRound )printStates(); // !!!!!!!!!!!!!!!
         // cout << "===========================" << endl;
         round++;
+        rounds++;
+        if(cut) return true;
     }
+}
+
+void Simulator::finish(){
+    if(partition != nullptr) partition->finish();
+    delete parallelMaxMin;
+    delete pool;
+    parallelMaxMin = nullptr;
+    pool = nullptr;
+    if(monitor != nullptr) monitor->finish();
+    if(!verbose) return;
     cout << "Simulation finished" << endl;
     cout << "Global Time: " << globalTime << endl;
+    cout << "Rounds: " << rounds << endl;
+    if(topology->aggregatedCollectives + topology->aggregationFallbacks > 0) {
+        cout << "In-network aggregation: " << topology->aggregatedCollectives << " DP collectives on trees, ";
+        cout << topology->aggregationFallbacks << " fell back to the ring" << endl;
+    }
+    if(critical != nullptr) critical->print();
+    if(monitor != nullptr) monitor->print();
+    printMemory();
     cout << "---------------------------" << endl;
+}
+
+void Simulator::printMemory(){
+    for(auto workload : workloads) {
+        bool modeled = false;
+        for(int pp = 0; pp < workload->PP; ++pp) {
+            if(workload->stageActivationMemory[pp] > 0 || workload->stageStaticMemory[pp] > 0) modeled = true;
+        }
+        if(!modeled || workload->trace != nullptr) continue;
+        const char* modes[] = {"stored", "recompute", "offload"};
+        cout << "Memory" << (workload->name.empty() ? "" : " of " + workload->name);
+        cout << " (activations " << modes[workload->activationMode] << "):" << endl;
+        vector<double> observed(workload->PP, 0);
+        for(auto rank : workload->ranks) {
+            if(rank->rankTask == nullptr || (partition != nullptr && !partition->owns(rank))) continue;
+            observed[rank->pp] = max(observed[rank->pp], rank->rankTask->peakMemory);
+        }
+        for(int pp = 0; pp < workload->PP; ++pp) {
+            double fixed = workload->stageStaticMemory[pp];
+            double peak = fixed + observed[pp];
+            cout << "  stage " << pp << ": static " << fixed / 1e9 << " GB, peak " << peak / 1e9;
+            cout << " GB (planned " << workload->peakMemory(pp) / 1e9 << " GB)";
+            if(workload->memoryCapacity > 0 && peak > workload->memoryCapacity) {
+                cout << ", exceeds " << workload->memoryCapacity / 1e9 << " GB";
+            }
+            cout << endl;
+        }
+    }
+}
+
+void Simulator::admitWorkloads(){
+    for(int i = 0; i < workloads.size(); ++i) {
+        if(!admitted[i] && workloads[i]->arrivalTime <= globalTime + TIME_RESOLUTION) {
+            initializeWorkload(workloads[i]);
+            admitted[i] = true;
+            for(auto task : tasks) {
+                task->critical = critical;
+                RankTask* rankTask = dynamic_cast<RankTask*>(task);
+                if(rankTask != nullptr) rankTask->jitter = jitter;
+            }
+            if(monitor != nullptr) monitor->attach(tasks);
+        }
+    }
+}
+
+void Simulator::recordIterations(){
+    for(auto workload : workloads) {
+        int next = workload->iterationEnds.size();
+        int ranks = partition != nullptr ? partition->ranks : workload->ranks.size();
+        while(next < workload->finishedRanks.size() && workload->finishedRanks[next] == ranks) {
+            workload->iterationEnds.push_back(globalTime);
+            next++;
+        }
+    }
+}
+
+bool Simulator::finished(){
+    for(auto workload : workloads) {
+        if(workload->iterationEnds.size() < workload->iterations) return false;
+    }
+    return true;
+}
+
+void Simulator::printJobs(){
+    cout << "Jobs:" << endl;
+    for(auto workload : workloads) {
+        int done = workload->iterationEnds.size();
+        cout << "  " << (workload->name.empty() ? "job" : workload->name);
+        cout << ": arrival " << workload->arrivalTime;
+        cout << ", iterations " << done << "/" << workload->iterations;
+        if(done > 0) {
+            double finish = workload->iterationEnds.back();
+            cout << ", finish " << finish;
+            cout << ", avg iteration time " << (finish - workload->arrivalTime) / done;
+        }
+        cout << endl;
+    }
 }
\ No newline at end of file
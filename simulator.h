@@ -27,16 +27,29 @@ class Connection;
 class Group;
 class Workload;
 class Topology;
+class Allocator;
+class WorkerPool;
+class Partition;
+class CongestionControl;
+class PacketDomain;
+class CriticalPath;
+class UtilizationMonitor;
+class Activity;
+class ComputeJitter;
 
 
 class Task {
 public:
+    virtual ~Task() {}
     virtual int handleEvents() = 0;
     virtual double stableTime() = 0;
     virtual void progress(double time) = 0;
 
 
     virtual void printStates() = 0;
+
+    CriticalPath* critical = nullptr;   // dependency recording, off when null
+    UtilizationMonitor* monitor = nullptr;  // utilization accounting, off when null
 };
 
 class Flow {
@@ -45,12 +58,21 @@ public:
     Node* dst;
     vector<Node*> path;
     vector<Link*> pathLinks;    
+    vector<pair<Link*, double>> linkShares;  // fraction of the throughput on each link
+    Link* bottleneck;   // link the allocator froze the flow on, null if it does not tell
     Flow(Connection* connection);
+    Connection* connection;
+    void route();   // take the connection's current path
+    bool disconnected();    // between two hosts with no path left: stalls, never finishes
 
     double remainingSize;
     double throughput;
     Collective* collective;
 
+    // congestion control state
+    bool controlled;
+    double rate, targetRate, alpha;
+
     double stableTime();
     void progress(double time);
 };
@@ -63,11 +85,17 @@ public:
     int microbatch;
     int accumulatedInvocations;
     int accumulatedSize;
+    double remainingLatency;    // alpha part, elapses before the flows send
+    bool aggregated;            // DP reduced in the switches, holds one of the fabric's trees
+    Activity* activity;         // critical path record
 
+    double latency();   // closed-form alpha-beta latency of the whole collective
+    bool done();
     double stableTime();
     void progress(double time);
 
-    Collective(Group* group, int microbatch, int accumulatedSize);
+    Collective(Group* group, int microbatch, int accumulatedSize, double size = -1); // size < 0: from workload
+    ~Collective();
 
     void printStates();
 };
@@ -78,6 +106,7 @@ public:
     Group* group;
     
     GroupTask(Group* group) ;
+    ~GroupTask();
 
     vector<RankTask*> senders;
     vector<RankTask*> receivers;
@@ -85,12 +114,15 @@ public:
     Collective* activeCollective;
     vector<Collective*> waitingCollectives;
     map<int, Collective*> accumulatingCollectives; // from microbatchId to collective
+    int invocationsPerCollective;   // invocations needed before a collective starts
+    map<int, double> invocationSizes;   // explicit sizes announced by the invoker (trace replay)
 
     vector<tuple<int, int>> events;    // < From, MB >
 
     int handleEvents();
     double stableTime();
     void progress(double time);
+    void reset();   // no collectives, no events
 
     void printStates() ;
 
@@ -108,10 +140,32 @@ public:
 
     RankState state;
     int microbatch;
+    int iteration;
     double remainingTime;
+    Activity* released = nullptr;   // critical path: last activity that unblocked the rank
+    Activity* computing = nullptr;
+    double stateTime[6] = {0, 0, 0, 0, 0, 0};  // per RankState, while monitored
+    double stateSince = -1;
+    void setState(RankState next);
+
+    // activation memory
+    double clock = 0;               // simulated time, for the timeline
+    double activationMemory = 0, peakMemory = 0;
+    vector<pair<double, double>> memoryTimeline;    // < time, bytes > at every change
+    void addMemory(double bytes);
+    GroupTask* offloadGroupTask = nullptr;
+    GroupTask* reloadGroupTask = nullptr;
+    set<int> offloading, offloaded, reloading;  // microbatches on their way out, on the host, on their way back
+    void offload(int microbatch);
+    void reload(int microbatch);
+    bool resident(int microbatch);  // the backward of -microbatch may start
 
     vector<tuple<int, int, int>> events; // < EP, TYPE, MB >
+    ComputeJitter* jitter = nullptr;    // random compute times, profiled when null
 
+    void startIteration();
+    void reset();   // back to the start of the first iteration
+    virtual void notify(int endpoint, GroupTask* groupTask, int microbatch); // collective completion
     int handleEvents();
     double stableTime();
     void progress(double time);
@@ -120,20 +174,61 @@ public:
 };
 
 
+class LinkFault {
+public:
+    double time;
+    Link* link;
+    double capacity;    // <= 0: the link fails
+};
+
 class Simulator {
 public:
-    Workload* workload;
+    vector<Workload*> workloads;   // jobs sharing the topology
+    vector<bool> admitted;
     Topology* topology;
 
     vector<Task*> tasks;
     double globalTime;
+    int rounds = 0;     // since start() or a restore, one per distinct event time
+    bool verbose = true;
+    Allocator* allocator = nullptr;    // bandwidth sharing, max-min when null; not owned
+    CongestionControl* congestion = nullptr;    // rate dynamics during transients, off when null; not owned
+    PacketDomain* packets = nullptr;    // links simulated per packet, off when null; not owned
+    CriticalPath* critical = nullptr;   // critical path and bottleneck attribution, off when null; not owned
+    UtilizationMonitor* monitor = nullptr;  // rank state and link utilization report, off when null; not owned
+    int threads = 1;    // > 1: max-min allocation and stable time on a worker pool, same results
+    WorkerPool* pool = nullptr;         // during run() with threads > 1
+    Allocator* parallelMaxMin = nullptr;
+    Partition* partition = nullptr;     // this process's stages of a distributed run, all when null; not owned
+    ComputeJitter* jitter = nullptr;    // random compute times of 1F1B ranks, off when null; not owned
+
+    ~Simulator();
+
+    vector<LinkFault> faults;      // sorted by time
+    int nextFault = 0;
+    int reroutedConnections = 0;
+    int migratedFlows = 0;
+    set<Group*> rebuiltTrees;      // groups whose reduction tree a fault replaced
+    void applyFault(LinkFault& fault);
 
     void initialize();
+    void reset();                // state of initialize() for another run, tasks kept; 1F1B workloads admitted at time 0
+    void initializeWorkload(Workload* workload);
+    void initializeTrace(Workload* workload);
+    void admitWorkloads();
+    void recordIterations();
     void updateStates(); // waiter filling
-    void run() ;
+    double stableTime();    // earliest task change
+    void run() ;                 // start, advance to the end, finish
+    void start();                // time 0
+    bool advance(double until);  // rounds up to `until`, the last one past it in a congestion transient; false once nothing is left to do
+    void finish();               // reports
 
     void printStates();
     void print() ;
+    void printJobs();
+    void printMemory(); // planned and observed peak per stage
+    bool finished();    // every job completed its iterations
 };
 
 
@@ -9,6 +9,9 @@
 #include <queue>
 #include <unordered_set>
 #include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <limits>
 
 using namespace std;
 
@@ -18,8 +21,12 @@ void Node::print() {
         case TOR: cout << "TOR"; break;
         case AGG: cout << "AGG"; break;
         case CORE: cout << "CORE"; break;
+        case NVSWITCH: cout << "NVSwitch"; break;
+        case NIC: cout << "NIC"; break;
     }
-    cout << " " << id << endl;
+    cout << " " << id;
+    if (server >= 0) cout << " (server " << server << ", GPU " << gpu << ")";
+    cout << endl;
     cout << "Links: ";
     for (auto link : links) {
         cout << link->id << " ";
@@ -39,71 +46,85 @@ void Link::print() {
 
 
 void Topology::generateFattree(int switch_radix, int pods, double capacity){
-    int numHosts = pods * ( switch_radix / 2 ) * ( switch_radix / 2 );
-    int numTOR = pods * ( switch_radix / 2 );
-    int numAGG = pods * ( switch_radix / 2 );
-    int numCore = ( switch_radix * switch_radix ) / 4; 
+    int half = switch_radix / 2;
+    generateClos(pods, half, half, half, half, capacity, capacity, capacity);
+}
 
-    int nodeId = 0;
-    // build hosts
+void Topology::connect(Node* a, Node* b, double capacity){
+    Link* link1 = new Link(links.size(), a, b, capacity);
+    links.push_back(link1);
+    a->links.push_back(link1);
+    Link* link2 = new Link(links.size(), b, a, capacity);
+    links.push_back(link2);
+    b->links.push_back(link2);
+}
+
+// 3-tier Clos: every TOR connects to every AGG of its pod, AGG j of every pod
+// connects to the aggUplinks cores of plane j. generateFattree(k) is
+// pods x (k/2 TOR, k/2 hosts per TOR, k/2 AGG) with k/2 uplinks per AGG.
+void Topology::generateClos(int pods, int torsPerPod, int hostsPerTor, int aggsPerPod, int aggUplinks,
+                            double hostSpeed, double torSpeed, double aggSpeed){
+    int numHosts = pods * torsPerPod * hostsPerTor;
+    int numTOR = pods * torsPerPod;
+    int numAGG = pods * aggsPerPod;
+    int numCore = aggsPerPod * aggUplinks;
+    int hostBase = nodes.size();
+    int torBase = hostBase + numHosts;
+    int aggBase = torBase + numTOR;
+    int coreBase = aggBase + numAGG;
+
+    nodes.reserve(coreBase + numCore);
+    links.reserve(links.size() + 2 * (numHosts + numTOR * aggsPerPod + numAGG * aggUplinks));
     for(int i = 0; i < numHosts; ++i) {
-        nodes.push_back(new Node(nodeId++, NodeType::HOST));
+        nodes.push_back(new Node(nodes.size(), NodeType::HOST));
     }
-
-    // build TOR
     for(int i = 0; i < numTOR; ++i) {
-        nodes.push_back(new Node(nodeId++, NodeType::TOR));
+        nodes.push_back(new Node(nodes.size(), NodeType::TOR));
+        nodes.back()->links.reserve(hostsPerTor + aggsPerPod);
     }
-
-    // build AGG
     for(int i = 0; i < numAGG; ++i) {
-        nodes.push_back(new Node(nodeId++, NodeType::AGG));
+        nodes.push_back(new Node(nodes.size(), NodeType::AGG));
+        nodes.back()->links.reserve(torsPerPod + aggUplinks);
     }
-
-    // build Core
     for(int i = 0; i < numCore; ++i) {
-        nodes.push_back(new Node(nodeId++, NodeType::CORE));
+        nodes.push_back(new Node(nodes.size(), NodeType::CORE));
+        nodes.back()->links.reserve(pods);
     }
 
-    int linkId = 0;
     // connect host-TOR
     for(int i = 0; i < numHosts; ++i) {
-        int torIndex = i / (switch_radix / 2);
-        Link* link1 = new Link(linkId++, nodes[i], nodes[torIndex + numHosts], capacity);
-        Link* link2 = new Link(linkId++, nodes[torIndex + numHosts], nodes[i], capacity);
-        links.push_back(link1);
-        links.push_back(link2);
-        nodes[i]->links.push_back(link1);
-        nodes[torIndex + numHosts]->links.push_back(link2);
+        connect(nodes[hostBase + i], nodes[torBase + i / hostsPerTor], hostSpeed);
     }
 
     // connect TOR-AGG
     for(int i = 0; i < numTOR; ++i) {
-        int pod = i / (switch_radix / 2);
-        for(int j = 0; j < (switch_radix / 2); ++j) {
-            int aggIndex = pod * (switch_radix / 2) + j;
-            Link* link1 = new Link(linkId++, nodes[i + numHosts], nodes[aggIndex + numHosts + numTOR], capacity);
-            Link* link2 = new Link(linkId++, nodes[aggIndex + numHosts + numTOR], nodes[i + numHosts], capacity);
-            links.push_back(link1);
-            links.push_back(link2);
-            nodes[i + numHosts]->links.push_back(link1);
-            nodes[aggIndex + numHosts + numTOR]->links.push_back(link2);
+        int pod = i / torsPerPod;
+        for(int j = 0; j < aggsPerPod; ++j) {
+            connect(nodes[torBase + i], nodes[aggBase + pod * aggsPerPod + j], torSpeed);
         }
     }
 
-    // connect AGG-Core
+    // connect AGG-Core, AGG j of each pod to plane j
     for(int i = 0; i < numAGG; ++i) {
-        for(int j = 0; j < (switch_radix / 2); ++j) {
-            int coreIndex = j;
-            Link* link1 = new Link(linkId++, nodes[i + numHosts + numTOR], nodes[coreIndex + numHosts + numTOR + numAGG], capacity);
-            Link* link2 = new Link(linkId++, nodes[coreIndex + numHosts + numTOR + numAGG], nodes[i + numHosts + numTOR], capacity);
-            links.push_back(link1);
-            links.push_back(link2);
-            nodes[i + numHosts + numTOR]->links.push_back(link1);
-            nodes[coreIndex + numHosts + numTOR + numAGG]->links.push_back(link2);
+        int plane = i % aggsPerPod;
+        for(int j = 0; j < aggUplinks; ++j) {
+            connect(nodes[aggBase + i], nodes[coreBase + plane * aggUplinks + j], aggSpeed);
         }
     }
+    routingReady = false;
+}
 
+// Split each switch's radix into down and up ports so that down:up
+// bandwidth matches the requested oversubscription at the TOR and AGG
+// tiers: h * down speed = ratio * (radix - h) * up speed.
+void Topology::generateOversubscribedClos(int switch_radix, int pods, double torOversubscription, double aggOversubscription,
+                                          double hostSpeed, double torSpeed, double aggSpeed){
+    int hostsPerTor = (int)(switch_radix * torOversubscription * torSpeed / (hostSpeed + torOversubscription * torSpeed) + 0.5);
+    int torsPerPod = (int)(switch_radix * aggOversubscription * aggSpeed / (torSpeed + aggOversubscription * aggSpeed) + 0.5);
+    hostsPerTor = max(1, min(switch_radix - 1, hostsPerTor));
+    torsPerPod = max(1, min(switch_radix - 1, torsPerPod));
+    generateClos(pods, torsPerPod, hostsPerTor, switch_radix - hostsPerTor, switch_radix - torsPerPod,
+                 hostSpeed, torSpeed, aggSpeed);
 }
 
 void Topology::generateOneBigSwitch(int switch_radix, double capacity) {
@@ -131,47 +152,547 @@ void Topology::generateOneBigSwitch(int switch_radix, double capacity) {
 }
 
 
-vector<Node*> Topology::ECMP(Node* src, Node* dst) {  // Prompt：运行bfs搜索所有路径，并随机返回一条
-    vector<vector<Node*>> allPaths;
-    queue<vector<Node*>> q;
-    unordered_set<Node*> visited;
+// Rail-optimized fabric: every GPU has its own NIC, and NIC i of the servers
+// in a rail group connects to rail switch i of that group. With several
+// planes each NIC has one port per plane. Spines of a plane connect all of
+// its rail switches, so only cross-rail traffic leaves the rail switch.
+void Topology::generateRailOptimized(int servers, int gpusPerServer, int serversPerRail, int planes, int spinesPerPlane,
+                                     double nicSpeed, double spineSpeed){
+    int groups = (servers + serversPerRail - 1) / serversPerRail;
+    int gpuBase = nodes.size();
+    int railBase = gpuBase + servers * gpusPerServer;
+    int spineBase = railBase + groups * planes * gpusPerServer;
 
-    // Start BFS from the source node
-    q.push({src});
+    nodes.reserve(spineBase + planes * spinesPerPlane);
+    links.reserve(links.size() + 2 * planes * gpusPerServer * (servers + groups * spinesPerPlane));
+    for(int s = 0; s < servers; ++s) {
+        for(int g = 0; g < gpusPerServer; ++g) {
+            Node* gpu = new Node(nodes.size(), NodeType::HOST);
+            gpu->server = s;
+            gpu->gpu = g;
+            nodes.push_back(gpu);
+        }
+    }
+    for(int i = 0; i < groups * planes * gpusPerServer; ++i) {  // rail switches, group-major, then plane, then rail
+        nodes.push_back(new Node(nodes.size(), NodeType::TOR));
+    }
+    for(int i = 0; i < planes * spinesPerPlane; ++i) {
+        nodes.push_back(new Node(nodes.size(), NodeType::AGG));
+    }
+
+    // connect GPU NIC - rail switch, one port per plane
+    for(int s = 0; s < servers; ++s) {
+        int group = s / serversPerRail;
+        for(int g = 0; g < gpusPerServer; ++g) {
+            for(int p = 0; p < planes; ++p) {
+                int rail = (group * planes + p) * gpusPerServer + g;
+                connect(nodes[gpuBase + s * gpusPerServer + g], nodes[railBase + rail], nicSpeed);
+            }
+        }
+    }
+
+    // connect rail switch - spine, within a plane
+    for(int group = 0; group < groups; ++group) {
+        for(int p = 0; p < planes; ++p) {
+            for(int g = 0; g < gpusPerServer; ++g) {
+                int rail = (group * planes + p) * gpusPerServer + g;
+                for(int i = 0; i < spinesPerPlane; ++i) {
+                    connect(nodes[railBase + rail], nodes[spineBase + p * spinesPerPlane + i], spineSpeed);
+                }
+            }
+        }
+    }
+    routingReady = false;
+}
+
+// Group hosts into servers of gpusPerServer GPUs in id order.
+void Topology::assignServers(int gpusPerServer){
+    int index = 0;
+    for(auto node : nodes) {
+        if(node->type != NodeType::HOST) continue;
+        node->server = index / gpusPerServer;
+        node->gpu = index % gpusPerServer;
+        index++;
+    }
+}
+
+// Add the intra-server fabric to every server: an NVSwitch connecting its
+// GPUs with nvlinkSpeed links, and, if pcieSpeed > 0, a NIC between each GPU
+// and each of its network switches, attached to the GPU over PCIe.
+void Topology::addServerFabric(double nvlinkSpeed, double pcieSpeed){
+    map<int, vector<Node*>> servers;
+    for(auto node : nodes) {
+        if(node->type == NodeType::HOST && node->server >= 0) {
+            servers[node->server].push_back(node);
+        }
+    }
+    for(auto& it : servers) {
+        if(pcieSpeed > 0) {
+            for(auto gpu : it.second) {
+                vector<Link*> uplinks = gpu->links;
+                for(auto uplink : uplinks) {
+                    Node* sw = uplink->dst;
+                    if(sw->type == NodeType::NVSWITCH || sw->type == NodeType::NIC) continue;
+                    Node* nic = new Node(nodes.size(), NodeType::NIC);
+                    nic->server = gpu->server;
+                    nic->gpu = gpu->gpu;
+                    nodes.push_back(nic);
+                    // rewire GPU <-> switch as NIC <-> switch
+                    gpu->links.erase(find(gpu->links.begin(), gpu->links.end(), uplink));
+                    uplink->src = nic;
+                    nic->links.push_back(uplink);
+                    for(auto downlink : sw->links) {
+                        if(downlink->dst == gpu) {
+                            downlink->dst = nic;
+                            break;
+                        }
+                    }
+                    connect(gpu, nic, pcieSpeed);
+                }
+            }
+        }
+        if(nvlinkSpeed > 0) {
+            Node* nvswitch = new Node(nodes.size(), NodeType::NVSWITCH);
+            nvswitch->server = it.first;
+            nodes.push_back(nvswitch);
+            for(auto gpu : it.second) {
+                connect(gpu, nvswitch, nvlinkSpeed);
+            }
+        }
+    }
+    routingReady = false;
+}
+
+static const int TOR_LEVEL = 2;
+
+static int nodeLevel(NodeType type){
+    switch(type) {
+        case HOST: return 0;
+        case NIC: return 1;
+        case NVSWITCH: return 1;
+        case TOR: return TOR_LEVEL;
+        case AGG: return 3;
+        case CORE: return 4;
+    }
+    return 0;
+}
+
+// For each switch, the set of TORs below it as a bitset, used to pick
+// up-down shortest paths hop by hop. Adjacency is kept as node ids split
+// into up and down neighbors to avoid chasing Link pointers. Hosts reach
+// their TORs directly or through a NIC; an NVSwitch only reaches the GPUs
+// of its server.
+void Topology::buildRoutingTables(){
+    int n = nodes.size();
+    level.assign(n, 0);
+    for(auto node : nodes) {
+        level[node->id] = nodeLevel(node->type);
+    }
+    upNeighbors.assign(n, vector<int>());
+    downNeighbors.assign(n, vector<int>());
+    for(auto link : links) {
+        if(link->failed) continue;
+        int a = link->src->id, b = link->dst->id;
+        if(level[b] > level[a]) upNeighbors[a].push_back(b);
+        else if(level[b] < level[a]) downNeighbors[a].push_back(b);
+    }
+    hostTors.assign(n, vector<int>());
+    for(int i = 0; i < n; ++i) {
+        if(level[i] != 0) continue;
+        for(auto up : upNeighbors[i]) {
+            if(level[up] == TOR_LEVEL) hostTors[i].push_back(up);
+            else for(auto tor : upNeighbors[up]) {
+                if(level[tor] == TOR_LEVEL) hostTors[i].push_back(tor);
+            }
+        }
+    }
+
+    int leaves = 0;
+    leafIndex.assign(n, -1);
+    for(int i = 0; i < n; ++i) {
+        if(level[i] == TOR_LEVEL) leafIndex[i] = leaves++;
+    }
+    reachWords = (leaves + 63) / 64;
+    reachOffset.assign(n, -1);
+    int switches = 0;
+    for(int i = 0; i < n; ++i) {
+        if(level[i] >= TOR_LEVEL) reachOffset[i] = reachWords * switches++;
+    }
+    downReach.assign((size_t)reachWords * switches, 0);
+    for(int l = TOR_LEVEL; l <= nodeLevel(CORE); ++l) {
+        for(int i = 0; i < n; ++i) {
+            if(level[i] != l) continue;
+            uint64_t* reach = &downReach[reachOffset[i]];
+            if(l == TOR_LEVEL) {
+                reach[leafIndex[i] / 64] |= 1ULL << (leafIndex[i] % 64);
+                continue;
+            }
+            for(auto below : downNeighbors[i]) {
+                if(level[below] != l - 1) continue;
+                const uint64_t* other = &downReach[reachOffset[below]];
+                for(int w = 0; w < reachWords; ++w) reach[w] |= other[w];
+            }
+        }
+    }
+    routingReady = true;
+}
+
+bool Topology::reachesDown(int node, int dst){  // dst is a host or a TOR
+    if(node == dst) return true;
+    if(level[node] <= level[dst] || level[dst] > TOR_LEVEL) return false;
+    if(level[node] < TOR_LEVEL) {   // NIC or NVSwitch, directly above dst
+        for(auto up : upNeighbors[dst]) {
+            if(up == node) return true;
+        }
+        return false;
+    }
+    const uint64_t* reach = &downReach[reachOffset[node]];
+    if(level[dst] == TOR_LEVEL) {
+        return (reach[leafIndex[dst] / 64] >> (leafIndex[dst] % 64)) & 1;
+    }
+    for(auto tor : hostTors[dst]) {
+        if((reach[leafIndex[tor] / 64] >> (leafIndex[tor] % 64)) & 1) return true;
+    }
+    return false;
+}
 
-    while (!q.empty()) {
-        vector<Node*> path = q.front();
+// Random shortest path by BFS distances from dst, for graphs that are not up-down trees.
+vector<Node*> Topology::shortestPath(Node* src, Node* dst){
+    vector<int> dist(nodes.size(), -1);
+    vector<vector<Node*>> reverse(nodes.size());
+    for(auto link : links) {
+        if(!link->failed) reverse[link->dst->id].push_back(link->src);
+    }
+    queue<Node*> q;
+    dist[dst->id] = 0;
+    q.push(dst);
+    while(!q.empty() && dist[src->id] < 0) {
+        Node* current = q.front();
         q.pop();
-        Node* current = path.back();
+        for(auto prev : reverse[current->id]) {
+            if(dist[prev->id] < 0) {
+                dist[prev->id] = dist[current->id] + 1;
+                q.push(prev);
+            }
+        }
+    }
+    if(dist[src->id] < 0) return {};
+
+    vector<Node*> path = {src};
+    while(path.back() != dst) {
+        vector<Node*> next;
+        for(auto link : path.back()->links) {
+            if(!link->failed && dist[link->dst->id] == dist[path.back()->id] - 1) next.push_back(link->dst);
+        }
+        path.push_back(next[random() % next.size()]);
+    }
+    return path;
+}
 
-        // If we reach the destination, store the path
-        if (current == dst) {
-            allPaths.push_back(path);
-            continue;
+// Equal-cost next hops of an up-down route: towards dst once it is below
+// node, otherwise up through switches that cover dst or can climb further.
+void Topology::nextHops(int node, int dst, vector<int>& candidates){
+    candidates.clear();
+    if(reachesDown(node, dst)) {
+        for(auto next : downNeighbors[node]) {
+            if(reachesDown(next, dst)) candidates.push_back(next);
+        }
+        return;
+    }
+    bool turning = false;   // some uplink already covers dst
+    for(auto next : upNeighbors[node]) {
+        bool covers = reachesDown(next, dst);
+        if(covers && !turning) {
+            candidates.clear();
+            turning = true;
         }
+        if(covers || (!turning && !upNeighbors[next].empty())) candidates.push_back(next);
+    }
+}
+
+// Up-down ECMP: climb through random uplinks until a switch above dst is
+// reached, then descend through random downlinks towards dst.
+vector<Node*> Topology::ECMP(Node* src, Node* dst) {
+    if(!routingReady) buildRoutingTables();
+    vector<Node*> path = {src};
+    vector<int> candidates;
+    int current = src->id;
+    while(current != dst->id) {
+        nextHops(current, dst->id, candidates);
+        if(candidates.empty()) return shortestPath(src, dst);
+        current = candidates[random() % candidates.size()];
+        path.push_back(nodes[current]);
+    }
+    return path;
+}
+
+Link* Topology::linkBetween(int src, int dst){
+    for(auto link : nodes[src]->links) {
+        if(link->dst->id == dst && !link->failed) return link;
+    }
+    return nullptr;
+}
+
+// Split amount over links so that the most loaded one, relative to its
+// capacity, is as low as possible (water level over load / capacity).
+static vector<double> splitByLoad(const vector<Link*>& hop, const vector<double>& load, double amount){
+    int n = hop.size();
+    vector<int> order(n);
+    for(int i = 0; i < n; ++i) order[i] = i;
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        return load[a] / hop[a]->capacity < load[b] / hop[b]->capacity;
+    });
+    double level = 0, filledLoad = 0, filledCapacity = 0;
+    int filled = 0;
+    while(filled < n) {
+        int i = order[filled];
+        filledLoad += load[i];
+        filledCapacity += hop[i]->capacity;
+        filled++;
+        level = (amount + filledLoad) / filledCapacity;
+        if(filled == n || level <= load[order[filled]] / hop[order[filled]]->capacity) break;
+    }
+    vector<double> split(n, 0);
+    for(int k = 0; k < filled; ++k) {
+        int i = order[k];
+        split[i] = max(0.0, level * hop[i]->capacity - load[i]);
+    }
+    return split;
+}
 
-        // Mark the current node as visited for this path
-        visited.insert(current);
+// Fraction of the src -> dst traffic carried by each link when it is spread
+// over the up-down equal-cost paths. Width 0 splits at every hop, covering
+// all paths with per-link fractions instead of enumerating them; width k
+// sends k equal parts along k distinct paths. Without load the split is
+// even (packet spraying); with load, the placed traffic per link id, it
+// favours the least-loaded links (adaptive routing).
+vector<pair<Link*, double>> Topology::spray(Node* src, Node* dst, int width, const vector<double>* load){
+    if(!routingReady) buildRoutingTables();
+    map<int, double> shares;    // link id -> fraction
+    vector<int> candidates;
+    auto placed = [&](Link* link) {
+        auto it = shares.find(link->id);
+        return (load != nullptr ? (*load)[link->id] : 0) + (it != shares.end() ? it->second : 0);
+    };
+    auto shortest = [&]() {
+        vector<Node*> path = shortestPath(src, dst);
+        vector<pair<Link*, double>> out;
+        for(int i = 0; i + 1 < path.size(); ++i) {
+            out.push_back(make_pair(linkBetween(path[i]->id, path[i + 1]->id), 1.0));
+        }
+        return out;
+    };
 
-        // Explore neighbors
-        for (auto link : current->links) {
-            Node* neighbor = link->dst;
-            if (visited.find(neighbor) == visited.end()) {
-                vector<Node*> newPath = path;
-                newPath.push_back(neighbor);
-                q.push(newPath);
+    if(width <= 0) {
+        map<int, double> frontier = {{src->id, 1.0}};
+        while(!frontier.empty()) {
+            map<int, double> next;
+            for(auto it : frontier) {
+                if(it.first == dst->id) continue;
+                nextHops(it.first, dst->id, candidates);
+                if(candidates.empty()) return shortest();
+                vector<Link*> hop;
+                vector<double> hopLoad;
+                for(auto c : candidates) {
+                    hop.push_back(linkBetween(it.first, c));
+                    hopLoad.push_back(placed(hop.back()));
+                }
+                vector<double> split = load != nullptr ? splitByLoad(hop, hopLoad, it.second)
+                                                       : vector<double>(hop.size(), it.second / hop.size());
+                for(int i = 0; i < hop.size(); ++i) {
+                    if(split[i] <= 0) continue;
+                    shares[hop[i]->id] += split[i];
+                    next[candidates[i]] += split[i];
+                }
+            }
+            frontier.swap(next);
+        }
+    }
+    else {
+        // path i picks hops by the digits of base + i, so parts take distinct paths
+        long long base = random();
+        for(int i = 0; i < width; ++i) {
+            long long index = base + i;
+            int current = src->id;
+            while(current != dst->id) {
+                nextHops(current, dst->id, candidates);
+                if(candidates.empty()) return shortest();
+                int pick = index % candidates.size();
+                index /= candidates.size();
+                if(load != nullptr) {
+                    double best = numeric_limits<double>::infinity();
+                    for(int c = 0; c < candidates.size(); ++c) {
+                        Link* link = linkBetween(current, candidates[c]);
+                        double level = placed(link) / link->capacity;
+                        if(level < best) {
+                            best = level;
+                            pick = c;
+                        }
+                    }
+                }
+                Link* link = linkBetween(current, candidates[pick]);
+                shares[link->id] += 1.0 / width;
+                current = candidates[pick];
             }
         }
     }
 
-    // If no paths are found, return an empty vector
-    if (allPaths.empty()) {
-        return {};
+    vector<pair<Link*, double>> out;
+    for(auto it : shares) {
+        out.push_back(make_pair(links[it.first], it.second));
     }
+    return out;
+}
 
-    // Randomly select one path from allPaths
-    int randomIndex = rand() % allPaths.size();
-    return allPaths[randomIndex];
+void Topology::setLatency(double edgeLatency, double fabricLatency){
+    for(auto link : links) {
+        bool edge = false;
+        for(auto node : {link->src, link->dst}) {
+            if(node->type == HOST || node->type == NIC || node->type == NVSWITCH) edge = true;
+        }
+        link->latency = edge ? edgeLatency : fabricLatency;
+    }
+}
+
+unsigned Topology::random(){
+    return rng != nullptr ? (*rng)() >> 1 : rand();
+}
+
+Topology* Topology::clone(){
+    Topology* copy = new Topology();
+    for(auto node : nodes) {
+        Node* other = new Node(node->id, node->type);
+        other->server = node->server;
+        other->gpu = node->gpu;
+        copy->nodes.push_back(other);
+    }
+    for(auto link : links) {
+        Link* other = new Link(link->id, copy->nodes[link->src->id], copy->nodes[link->dst->id], link->capacity);
+        other->failed = link->failed;
+        other->latency = link->latency;
+        copy->links.push_back(other);
+    }
+    for(auto node : nodes) {
+        for(auto link : node->links) {
+            copy->nodes[node->id]->links.push_back(copy->links[link->id]);
+        }
+    }
+    copy->multipath = multipath;
+    copy->multipathWidth = multipathWidth;
+    copy->aggregationThroughput = aggregationThroughput;
+    copy->maxAggregationTrees = maxAggregationTrees;
+    return copy;
+}
+
+// A switch's reduction engine, a pseudo-link from the switch to itself so
+// the allocators share its throughput like any other link.
+Link* Topology::aggregationLink(Node* node){
+    auto it = aggregationLinks.find(node->id);
+    if(it != aggregationLinks.end()) return it->second;
+    Link* link = new Link(-1, node, node, aggregationThroughput);
+    aggregationLinks[node->id] = link;
+    return link;
+}
+
+Link* Topology::pcieLink(Node* host, bool toGpu, double capacity){
+    for(auto link : host->links) {
+        if(link->dst->type == NIC) return toGpu ? reverse(link) : link;
+    }
+    int key = host->id * 2 + toGpu;
+    auto it = pcieLinks.find(key);
+    if(it != pcieLinks.end()) return it->second;
+    Link* link = new Link(-1, host, host, capacity);
+    pcieLinks[key] = link;
+    return link;
+}
+
+// Reduction tree over the switches for the given hosts: rooted at one of the
+// lowest switches above all of them and grown down by up-down routing,
+// reusing tree nodes where there is a choice. Host i gets a share of every
+// tree link on its way to the root, up and down: 1/m on a link with m hosts
+// below it, so the coupled flows of a collective put one copy of the data
+// on each tree link. A switch reducing c children gets c/m per host below.
+bool Topology::aggregationTree(const vector<Node*>& hosts, vector<vector<pair<Link*, double>>>& shares){
+    if(!routingReady) buildRoutingTables();
+    shares.assign(hosts.size(), vector<pair<Link*, double>>());
+    vector<int> roots;
+    for(auto node : nodes) {
+        if(node->type == HOST || node->type == NIC) continue;
+        if(!roots.empty() && level[node->id] > level[roots[0]]) continue;
+        bool above = true;
+        for(auto host : hosts) {
+            if(!reachesDown(node->id, host->id)) {
+                above = false;
+                break;
+            }
+        }
+        if(!above) continue;
+        if(!roots.empty() && level[node->id] < level[roots[0]]) roots.clear();
+        roots.push_back(node->id);
+    }
+    if(roots.empty()) return false;
+    int root = roots[random() % roots.size()];
+
+    map<int, int> parent = {{root, -1}};
+    vector<vector<int>> paths(hosts.size());    // root ... host
+    vector<int> candidates;
+    for(int i = 0; i < hosts.size(); ++i) {
+        vector<int>& path = paths[i];
+        path.push_back(root);
+        while(path.back() != hosts[i]->id) {
+            int current = path.back();
+            nextHops(current, hosts[i]->id, candidates);
+            if(candidates.empty()) return false;
+            int next = -1;
+            vector<int> fresh;
+            for(auto c : candidates) {
+                auto it = parent.find(c);
+                if(it == parent.end()) fresh.push_back(c);
+                else if(it->second == current) next = c;    // a child already in the tree
+            }
+            if(next < 0 && !fresh.empty()) next = fresh[random() % fresh.size()];
+            if(next < 0) {  // joined the tree elsewhere: take its branch
+                next = candidates[0];
+                path.clear();
+                for(int n = next; n >= 0; n = parent[n]) path.insert(path.begin(), n);
+                continue;
+            }
+            parent[next] = current;
+            path.push_back(next);
+        }
+    }
+
+    map<int, int> below;    // hosts under each tree node
+    map<int, set<int>> children;
+    for(auto& path : paths) {
+        for(int k = 0; k < path.size(); ++k) {
+            below[path[k]]++;
+            if(k > 0) children[path[k - 1]].insert(path[k]);
+        }
+    }
+    for(int i = 0; i < hosts.size(); ++i) {
+        vector<int>& path = paths[i];
+        for(int k = 0; k + 1 < path.size(); ++k) {
+            Link* up = linkBetween(path[k + 1], path[k]);
+            Link* down = linkBetween(path[k], path[k + 1]);
+            if(up == nullptr || down == nullptr) return false;
+            double share = 1.0 / below[path[k + 1]];
+            shares[i].push_back(make_pair(up, share));
+            shares[i].push_back(make_pair(down, share));
+            Node* node = nodes[path[k]];
+            if(node->type != NIC && aggregationThroughput != numeric_limits<double>::infinity()) {
+                shares[i].push_back(make_pair(aggregationLink(node), (double)children[path[k]].size() / below[path[k]]));
+            }
+        }
+    }
+    return true;
+}
+
+Link* Topology::reverse(Link* link){
+    for(auto other : link->dst->links) {
+        if(other->dst == link->src) return other;
+    }
+    return nullptr;
 }
 
 void Topology::print() {
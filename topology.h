@@ -7,6 +7,10 @@
 #include <vector>
 #include <iostream>
 #include <set>
+#include <cstdint>
+#include <random>
+#include <map>
+#include <limits>
 
 using namespace std;
 
@@ -21,7 +25,11 @@ public:
     int id;
     NodeType type;
     vector<Link*> links;  // directed links from Node
-    Node(int id, NodeType type) : id(id), type(type) { rank = nullptr; }
+    Node(int id, NodeType type) : id(id), type(type) { rank = nullptr; server = -1; gpu = -1; }
+
+    // GPU endpoints of multi-GPU servers
+    int server;
+    int gpu;    // local GPU index, also its rail
 
     // workload
     Rank* rank;
@@ -38,11 +46,15 @@ public:
     Node* src;
     Node* dst;
     double capacity;
-    Link(int id, Node* src, Node* dst, double capacity = 0.0) : id(id), src(src), dst(dst), capacity(capacity) {}
+    Link(int id, Node* src, Node* dst, double capacity = 0.0) : id(id), src(src), dst(dst), capacity(capacity) { failed = false; load = 0; latency = 0; arrival = 0; }
+    bool failed;    // excluded from routing
+    double latency; // propagation + switching delay, seconds
 
     // simulator related 
     double throughput;
     set<Flow*> flows; // flows using this link
+    double load;      // sum of their shares, flows.size() without multipath
+    double arrival;   // congestion control: offered rate
 
     void print() ;
 };
@@ -59,13 +71,67 @@ public:
         for (auto link : links) {
             delete link;
         }
+        for (auto it : aggregationLinks) {
+            delete it.second;
+        }
+        for (auto it : pcieLinks) {
+            delete it.second;
+        }
     }
 
     void generateFattree(int switch_radix, int pods, double capacity);
+    void generateClos(int pods, int torsPerPod, int hostsPerTor, int aggsPerPod, int aggUplinks,
+                      double hostSpeed, double torSpeed, double aggSpeed);
+    void generateOversubscribedClos(int switch_radix, int pods, double torOversubscription, double aggOversubscription,
+                                    double hostSpeed, double torSpeed, double aggSpeed);
     void generateOneBigSwitch(int switch_radix, double capacity);
+    void generateRailOptimized(int servers, int gpusPerServer, int serversPerRail, int planes, int spinesPerPlane,
+                               double nicSpeed, double spineSpeed);
+    void assignServers(int gpusPerServer);
+    void addServerFabric(double nvlinkSpeed, double pcieSpeed);
+    void connect(Node* a, Node* b, double capacity);   // a pair of directed links
+    void setLatency(double edgeLatency, double fabricLatency); // links at hosts/NICs, links between switches
     // void routing();
 
     vector<Node*> ECMP(Node* src, Node* dst);
+    Link* reverse(Link* link);
+    Topology* clone();  // same nodes and links, no routing state
+
+    mt19937* rng = nullptr;     // per-run routing stream, rand() when null
+    unsigned random();
+    Link* linkBetween(int src, int dst);
+
+    // multipath routing: a connection's traffic split over equal-cost paths
+    MultipathMode multipath = SINGLE_PATH;
+    int multipathWidth = 0;                 // paths per connection, 0: all
+    vector<pair<Link*, double>> spray(Node* src, Node* dst, int width, const vector<double>* load = nullptr);
+
+    // in-network aggregation: switches reduce DP gradients on a tree
+    double aggregationThroughput = numeric_limits<double>::infinity();   // bytes/s a switch can reduce
+    int maxAggregationTrees = 0;            // trees in use at once in the fabric, 0: unlimited
+    int activeAggregationTrees = 0;
+    int aggregatedCollectives = 0, aggregationFallbacks = 0;
+    map<int, Link*> aggregationLinks;       // switch id -> its reduction engine as a pseudo-link
+    Link* aggregationLink(Node* node);
+    bool aggregationTree(const vector<Node*>& hosts, vector<vector<pair<Link*, double>>>& shares);
+
+    // GPU <-> host memory: the PCIe link to the NIC when the server has one
+    map<int, Link*> pcieLinks;              // host id * 2 + direction -> pseudo-link otherwise
+    Link* pcieLink(Node* host, bool toGpu, double capacity);
+
+    // routing tables
+    bool routingReady = false;
+    vector<int> level;                      // node id -> tier, 0 for hosts
+    vector<vector<int>> upNeighbors, downNeighbors;
+    vector<vector<int>> hostTors;           // host id -> TORs it attaches to
+    vector<int> leafIndex;                  // node id -> index among TORs, -1 otherwise
+    int reachWords;
+    vector<int> reachOffset;                // node id -> offset of its bitset, -1 for hosts
+    vector<uint64_t> downReach;             // per switch, bitset of TORs below it
+    void buildRoutingTables();
+    bool reachesDown(int node, int dst);
+    void nextHops(int node, int dst, vector<int>& candidates);
+    vector<Node*> shortestPath(Node* src, Node* dst);
 
     void print();
 };
@@ -0,0 +1,476 @@
+#include "trace.h"
+#include "critical.h"
+#include "common.h"
+
+#include <iostream>
+#include <sstream>
+#include <limits>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace std;
+
+
+static string trim(const string& s){
+    size_t b = s.find_first_not_of(" \t\r");
+    if(b == string::npos) return "";
+    size_t e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+static vector<string> split(const string& s, const string& delims){
+    vector<string> out;
+    size_t b = 0;
+    while(b <= s.size()) {
+        size_t e = s.find_first_of(delims, b);
+        if(e == string::npos) e = s.size();
+        string token = trim(s.substr(b, e - b));
+        if(!token.empty() || delims == ",") out.push_back(token);
+        b = e + 1;
+    }
+    return out;
+}
+
+static bool parseNumber(const string& s, double& value){
+    if(s.empty()) return false;
+    char* end;
+    value = strtod(s.c_str(), &end);
+    return *end == '\0';
+}
+
+static bool parseGroupType(const string& s, GroupType& type){
+    if(s == "TP") type = GroupType::TP;
+    else if(s == "PP") type = GroupType::PP;
+    else if(s == "DP") type = GroupType::DP;
+    else return false;
+    return true;
+}
+
+// value of "key" in a flat JSON object: number, string or array of numbers
+static bool jsonField(const string& line, const string& key, string& value){
+    size_t p = line.find("\"" + key + "\"");
+    if(p == string::npos) return false;
+    p = line.find(':', p + key.size() + 2);
+    if(p == string::npos) return false;
+    p = line.find_first_not_of(" \t", p + 1);
+    if(p == string::npos) return false;
+    size_t e;
+    if(line[p] == '"') {
+        e = line.find('"', p + 1);
+        if(e == string::npos) return false;
+        value = line.substr(p + 1, e - p - 1);
+    }
+    else if(line[p] == '[') {
+        e = line.find(']', p);
+        if(e == string::npos) return false;
+        value = line.substr(p + 1, e - p - 1);
+    }
+    else {
+        e = line.find_first_of(",}", p);
+        if(e == string::npos) return false;
+        value = trim(line.substr(p, e - p));
+    }
+    return true;
+}
+
+// kind: "group", "compute", "coll", or empty for blank/comment lines
+static bool parseRecord(const string& raw, string& kind, int& rank, TraceOp& op, TraceGroup& group){
+    string line = trim(raw.substr(0, raw.find('#')));
+    kind = "";
+    if(line.empty()) return true;
+
+    // normalize both formats to: kind, fields by name
+    map<string, string> fields;
+    if(line[0] == '{') {
+        if(!jsonField(line, "op", kind)) return false;
+        for(string key : {"rank", "duration", "group", "size", "deps", "type", "ranks"}) {
+            string value;
+            if(jsonField(line, key, value)) fields[key] = value;
+        }
+    }
+    else {
+        vector<string> cols = split(line, ",");
+        kind = cols[0];
+        vector<string> names;
+        if(kind == "group") names = {"group", "type", "ranks"};
+        else if(kind == "compute") names = {"rank", "duration", "deps"};
+        else if(kind == "coll") names = {"rank", "group", "size", "deps"};
+        else return false;
+        if(cols.size() - 1 > names.size()) return false;
+        for(int i = 1; i < cols.size(); ++i) {
+            fields[names[i - 1]] = cols[i];
+        }
+    }
+
+    double value;
+    if(kind == "group") {
+        if(!parseNumber(fields["group"], value)) return false;
+        group.id = (int)value;
+        if(!parseGroupType(fields["type"], group.type)) return false;
+        group.ranks.clear();
+        for(auto token : split(fields["ranks"], " ;,")) {
+            if(!parseNumber(token, value)) return false;
+            group.ranks.push_back((int)value);
+        }
+        return !group.ranks.empty() && (group.type != GroupType::PP || group.ranks.size() == 2);
+    }
+    if(kind != "compute" && kind != "coll") return false;
+
+    if(!parseNumber(fields["rank"], value) || value < 0) return false;
+    rank = (int)value;
+    op.isCompute = kind == "compute";
+    op.duration = 0;
+    op.group = -1;
+    op.size = 0;
+    if(op.isCompute) {
+        if(!parseNumber(fields["duration"], op.duration)) return false;
+    }
+    else {
+        if(!parseNumber(fields["group"], value)) return false;
+        op.group = (int)value;
+        if(!parseNumber(fields["size"], op.size)) return false;
+    }
+    op.deps.clear();
+    for(auto token : split(fields["deps"], " ;,")) {
+        if(!parseNumber(token, value)) return false;
+        op.deps.push_back((long long)value);
+    }
+    return true;
+}
+
+
+bool TraceReader::open(const string& path){
+    this->path = path;
+    in.open(path);
+    if(!in.is_open()) {
+        cerr << "Cannot open trace " << path << endl;
+        return false;
+    }
+
+    const int maxRuns = 16;         // byte ranges per rank before the trace is spilled
+    bool interleaved = false;
+    vector<streamoff> rankBytes;
+    map<int, int> groupIndex;
+    set<int> usedGroups;
+    string line, kind;
+    TraceOp op;
+    TraceGroup group;
+    int rank;
+    streamoff pos = 0;
+    long long lineNo = 0;
+    while(getline(in, line)) {
+        streamoff offset = pos;
+        pos += line.size() + 1;
+        lineNo++;
+        if(!parseRecord(line, kind, rank, op, group)) {
+            cerr << "Invalid trace record at " << path << ":" << lineNo << endl;
+            return false;
+        }
+        if(kind == "group") {
+            if(groupIndex.count(group.id)) {
+                cerr << "Duplicate group " << group.id << " at " << path << ":" << lineNo << endl;
+                return false;
+            }
+            groupIndex[group.id] = groups.size();
+            groups.push_back(group);
+        }
+        else if(!kind.empty()) {
+            if(rank >= blocks.size()) {
+                blocks.resize(rank + 1);
+                nextSeq.resize(rank + 1, 0);
+                rankBytes.resize(rank + 1, 0);
+            }
+            for(auto dep : op.deps) {
+                if(dep < 0 || dep >= nextSeq[rank]) {
+                    cerr << "Dependency on a later op at " << path << ":" << lineNo << endl;
+                    return false;
+                }
+            }
+            if(!op.isCompute) usedGroups.insert(op.group);
+            nextSeq[rank]++;
+            numOps++;
+            rankBytes[rank] += pos - offset;
+            if(interleaved) continue;
+            if(!blocks[rank].empty() && blocks[rank].back().second == offset) {
+                blocks[rank].back().second = pos;
+            }
+            else if(blocks[rank].size() < maxRuns) {
+                blocks[rank].push_back(make_pair(offset, pos));
+            }
+            else {
+                interleaved = true;
+                for(auto& b : blocks) vector<pair<streamoff, streamoff>>().swap(b);
+            }
+        }
+    }
+
+    // check collective groups and rank ids
+    for(auto g : usedGroups) {
+        if(!groupIndex.count(g)) {
+            cerr << "Collective on undeclared group " << g << endl;
+            return false;
+        }
+    }
+    int numRanks = blocks.size();
+    for(auto& g : groups) {
+        for(auto r : g.ranks) {
+            if(r < 0) {
+                cerr << "Invalid rank in group " << g.id << endl;
+                return false;
+            }
+            numRanks = max(numRanks, r + 1);
+        }
+    }
+    blocks.resize(numRanks);
+    rankBytes.resize(numRanks, 0);
+    if(interleaved && !spill(rankBytes)) return false;
+
+    // rewind cursors
+    cursorBlock.assign(numRanks, 0);
+    cursorOffset.assign(numRanks, 0);
+    nextSeq.assign(numRanks, 0);
+    for(int r = 0; r < numRanks; ++r) {
+        if(!blocks[r].empty()) cursorOffset[r] = blocks[r][0].first;
+    }
+    in.clear();
+    return true;
+}
+
+// Copy op records into a temporary file laid out rank after rank, then
+// index that file with one byte range per rank. Records are buffered per
+// rank and flushed in place whenever the buffers together exceed a bound.
+// The file is unlinked once reopened, so it goes away with the reader.
+bool TraceReader::spill(const vector<streamoff>& rankBytes){
+    const char* dir = getenv("TMPDIR");
+    string tmpl = string(dir != nullptr && *dir ? dir : "/tmp") + "/trace-XXXXXX";
+    vector<char> name(tmpl.begin(), tmpl.end());
+    name.push_back('\0');
+    int fd = mkstemp(name.data());
+    if(fd < 0) {
+        cerr << "Cannot create spill file for trace " << path << endl;
+        return false;
+    }
+    close(fd);
+    string spillPath = name.data();
+    fstream out(spillPath, ios::in | ios::out | ios::binary);
+
+    int numRanks = rankBytes.size();
+    vector<streamoff> writeAt(numRanks, 0);
+    for(int r = 1; r < numRanks; ++r) {
+        writeAt[r] = writeAt[r - 1] + rankBytes[r - 1];
+    }
+    for(int r = 0; r < numRanks; ++r) {
+        blocks[r].clear();
+        if(rankBytes[r] > 0) blocks[r].push_back(make_pair(writeAt[r], writeAt[r] + rankBytes[r]));
+    }
+
+    const size_t maxBuffered = 64 << 20;
+    vector<string> buffers(numRanks);
+    size_t buffered = 0;
+    auto flush = [&](){
+        for(int r = 0; r < numRanks; ++r) {
+            if(buffers[r].empty()) continue;
+            out.seekp(writeAt[r]);
+            out.write(buffers[r].data(), buffers[r].size());
+            writeAt[r] += buffers[r].size();
+            string().swap(buffers[r]);
+        }
+        buffered = 0;
+    };
+
+    in.clear();
+    in.seekg(0);
+    string line, kind;
+    TraceOp op;
+    TraceGroup group;
+    int rank;
+    while(getline(in, line)) {
+        parseRecord(line, kind, rank, op, group);  // validated by the index pass
+        if(kind != "compute" && kind != "coll") continue;
+        buffers[rank] += line;
+        buffers[rank] += '\n';
+        buffered += line.size() + 1;
+        if(buffered > maxBuffered) flush();
+    }
+    flush();
+    out.close();
+    if(out.fail()) {
+        cerr << "Cannot write spill file for trace " << path << endl;
+        remove(spillPath.c_str());
+        return false;
+    }
+
+    in.close();
+    in.open(spillPath);
+    remove(spillPath.c_str());
+    return in.is_open();
+}
+
+Workload* TraceReader::buildWorkload(){
+    Workload* workload = new Workload();
+    workload->trace = this;
+    for(int r = 0; r < blocks.size(); ++r) {
+        Rank* rank = new Rank(r, -1, -1, -1);
+        rank->workload = workload;
+        rank->tpGroup = rank->dpGroup = rank->ppFwdGroup = rank->ppBwdGroup = nullptr;
+        rank->host = nullptr;
+        workload->ranks.push_back(rank);
+    }
+    for(auto& g : groups) {
+        Group* group = new Group(g.id, g.type, -1, -1, -1);
+        group->workload = workload;
+        for(auto r : g.ranks) {
+            group->ranks.push_back(workload->ranks[r]);
+        }
+        group->createConnections();
+        workload->groups.push_back(group);
+        groupById[g.id] = group;
+    }
+    return workload;
+}
+
+bool TraceReader::readOps(int rank, deque<TraceOp>& out){
+    vector<pair<streamoff, streamoff>>& rankBlocks = blocks[rank];
+    int count = 0;
+    string line, kind;
+    TraceOp op;
+    TraceGroup group;
+    int opRank;
+    while(count < chunkSize && cursorBlock[rank] < rankBlocks.size()) {
+        in.clear();
+        in.seekg(cursorOffset[rank]);
+        streamoff end = rankBlocks[cursorBlock[rank]].second;
+        while(count < chunkSize && cursorOffset[rank] < end && getline(in, line)) {
+            cursorOffset[rank] += line.size() + 1;
+            parseRecord(line, kind, opRank, op, group);  // validated by the index pass
+            op.seq = nextSeq[rank]++;
+            out.push_back(op);
+            count++;
+        }
+        if(cursorOffset[rank] >= end || in.eof()) {
+            cursorBlock[rank]++;
+            if(cursorBlock[rank] < rankBlocks.size()) {
+                cursorOffset[rank] = rankBlocks[cursorBlock[rank]].first;
+            }
+        }
+    }
+    return count > 0;
+}
+
+
+TraceRankTask::TraceRankTask(Rank* rank, TraceReader* reader) : RankTask(rank), reader(reader) {
+    exhausted = false;
+    nextSeq = 0;
+    computeSeq = -1;
+    state = RankState::PP_WAIT;
+    microbatch = 0;
+    iteration = 0;
+    remainingTime = 0;
+}
+
+bool TraceRankTask::completed(long long seq){
+    return seq < nextSeq && pending.find(seq) == pending.end();
+}
+
+void TraceRankTask::notify(int endpoint, GroupTask* groupTask, int microbatch){
+    if(endpoint != EndpointType::RECV) return;  // ranks only receive completions
+    completions.push_back(make_tuple(groupTask->group->id, microbatch));
+}
+
+int TraceRankTask::handleEvents(){
+    int countEvents = completions.size();
+    for(auto completion : completions) {
+        auto it = outstanding.find(completion);
+        pending.erase(it->second);
+        outstanding.erase(it);
+    }
+    completions.clear();
+
+    // issue ops in trace order once their dependencies are complete
+    while(true) {
+        if(ops.empty() && !exhausted) {
+            if(!reader->readOps(rank->id, ops)) exhausted = true;
+        }
+        if(ops.empty()) break;
+        TraceOp& op = ops.front();
+        bool ready = true;
+        if(op.deps.empty()) {
+            ready = op.seq == 0 || completed(op.seq - 1);
+        }
+        for(auto dep : op.deps) {
+            if(!completed(dep)) ready = false;
+        }
+        if(!ready) break;
+        if(op.isCompute) {
+            if(computeSeq >= 0) break;  // one compute stream per rank
+            computeSeq = op.seq;
+            remainingTime = op.duration;
+            if(critical != nullptr) critical->computeStarted(this);
+        }
+        else {
+            GroupTask* groupTask = reader->groupById[op.group]->groupTask;
+            int invocation = ++invocations[op.group];
+            groupTask->invocationSizes[invocation] = op.size;
+            groupTask->events.push_back(make_tuple(rank->id, invocation));
+            outstanding[make_tuple(op.group, invocation)] = op.seq;
+        }
+        pending.insert(op.seq);
+        nextSeq = op.seq + 1;
+        ops.pop_front();
+        countEvents++;
+    }
+
+    if(computeSeq >= 0) setState(RankState::COMPUTE);
+    else if(exhausted && ops.empty() && pending.empty()) {
+        if(state != RankState::DONE) rank->workload->rankFinished(0);
+        setState(RankState::DONE);
+    }
+    else setState(RankState::PP_WAIT);
+    return countEvents;
+}
+
+double TraceRankTask::stableTime(){
+    if(computeSeq < 0) return numeric_limits<double>::infinity();
+    return remainingTime;
+}
+
+void TraceRankTask::progress(double time){
+    if(computeSeq < 0) return;
+    remainingTime -= time;
+    if(remainingTime <= TIME_RESOLUTION) {
+        pending.erase(computeSeq);
+        computeSeq = -1;
+        remainingTime = 0;
+        if(critical != nullptr) critical->computeFinished(this);
+        setState(RankState::PP_WAIT);
+    }
+}
+
+void TraceRankTask::printStates(){
+    cout << "---------------------------" << endl;
+    cout << "TraceRankTask:";
+    cout << " Rank: " << rank->id;
+    cout << ", State: " << (state == RankState::DONE ? "DONE" : state == RankState::COMPUTE ? "COMPUTE" : "WAIT");
+    cout << ", Next op: " << nextSeq;
+    cout << ", Pending ops: " << pending.size();
+    cout << ", Remaining time: " << remainingTime;
+    cout << endl;
+}
+
+
+void Simulator::initializeTrace(Workload* workload){
+    for(auto group : workload->groups) {
+        GroupTask* task = new GroupTask(group);
+        task->invocationsPerCollective = group->ranks.size();  // every member calls the collective
+        tasks.push_back(task);
+    }
+    for(auto rank : workload->ranks) {
+        tasks.push_back(new TraceRankTask(rank, workload->trace));
+    }
+    for(auto group : workload->groups) {
+        for(auto rank : group->ranks) {
+            group->groupTask->receivers.push_back(rank->rankTask);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "common.h"
+#include "workload.h"
+#include "simulator.h"
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <fstream>
+
+using namespace std;
+
+class TraceOp {
+public:
+    long long seq;          // per-rank op index, in trace order
+    bool isCompute;
+    double duration;        // compute
+    int group;              // collective
+    double size;            // collective
+    vector<long long> deps; // ops that must complete first, empty: previous op
+};
+
+class TraceGroup {
+public:
+    int id;
+    GroupType type;
+    vector<int> ranks;
+};
+
+// Streaming reader of per-rank compute/collective logs, CSV or JSON lines:
+//   group,<id>,<TP|PP|DP>,<rank> <rank> ...
+//   compute,<rank>,<duration>[,<dep> <dep> ...]
+//   coll,<rank>,<group>,<size>[,<dep> <dep> ...]
+//   {"op":"coll","rank":0,"group":3,"size":1e6,"deps":[1,2]}
+// The index pass keeps only the group table and, per rank, a few byte ranges
+// holding its records. A trace whose ranks interleave beyond that is copied
+// rank by rank into a temporary spill file through bounded buffers, so the
+// index stays O(ranks) either way. Ops are parsed chunk by chunk while the
+// replay advances.
+class TraceReader {
+public:
+    string path;
+    ifstream in;
+    int chunkSize;
+
+    vector<TraceGroup> groups;
+    vector<vector<pair<streamoff, streamoff>>> blocks;  // per rank, [begin, end) byte ranges
+    vector<int> cursorBlock;
+    vector<streamoff> cursorOffset;
+    vector<long long> nextSeq;
+    long long numOps;
+
+    map<int, Group*> groupById;
+
+    TraceReader() : chunkSize(256), numOps(0) {}
+
+    bool open(const string& path);
+    Workload* buildWorkload();
+    bool readOps(int rank, deque<TraceOp>& out);  // appends up to chunkSize ops, false at end of rank
+
+private:
+    bool spill(const vector<streamoff>& rankBytes);
+};
+
+class TraceRankTask : public RankTask {
+public:
+    TraceReader* reader;
+    TraceRankTask(Rank* rank, TraceReader* reader);
+
+    deque<TraceOp> ops;             // parsed, not yet issued
+    bool exhausted;
+    long long nextSeq;              // next op to issue
+    set<long long> pending;         // issued, not completed
+    long long computeSeq;           // running compute op, -1 if idle
+    map<int, int> invocations;      // group id -> collectives issued
+    map<tuple<int, int>, long long> outstanding;   // < group, invocation > -> op
+    vector<tuple<int, int>> completions;           // < group, invocation >
+
+    bool completed(long long seq);
+
+    void notify(int endpoint, GroupTask* groupTask, int microbatch);
+    int handleEvents();
+    double stableTime();
+    void progress(double time);
+
+    void printStates();
+};
+
+#endif // TRACE_H
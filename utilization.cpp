@@ -0,0 +1,226 @@
+#include "utilization.h"
+
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <cmath>
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+
+UtilizationMonitor::UtilizationMonitor(Topology* topology, const string& seriesPath, double tick, int topLinks) :
+    topology(topology), seriesPath(seriesPath), tick(tick), topLinks(topLinks), now(0), allocations(0), start(0), lastTick(0) {
+    int L = topology->links.size();
+    rate.assign(L, 0);
+    since.assign(L, 0);
+    carried.assign(L, 0);
+    offered.assign(L, 0);
+    level.assign(L, 0);
+    stamp.assign(L, -1);
+    if(seriesPath.empty()) return;
+    series.open(seriesPath, ios::binary);
+    if(!series.is_open()) {
+        cerr << "Cannot open utilization series " << seriesPath << endl;
+        return;
+    }
+    buffer.insert(buffer.end(), {'U', 'T', 'S', '1'});
+    writeVarint(L);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&tick);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(double));
+}
+
+UtilizationMonitor::~UtilizationMonitor(){
+    flush();
+}
+
+void UtilizationMonitor::attach(vector<Task*>& tasks){
+    for(auto task : tasks) {
+        if(task->monitor == this) continue;
+        task->monitor = this;
+        RankTask* rankTask = dynamic_cast<RankTask*>(task);
+        if(rankTask == nullptr) continue;
+        rankTask->stateSince = now;     // its first state was entered at admission
+        ranks.push_back(rankTask);
+    }
+}
+
+void UtilizationMonitor::setRate(int link, double value, vector<pair<int, int>>& changes){
+    if(value == rate[link]) return;
+    carried[link] += rate[link] * (now - since[link]);
+    since[link] = now;
+    rate[link] = value;
+    if(!series.is_open()) return;
+    double capacity = topology->links[link]->capacity;
+    int next = capacity > 0 ? (int)min(65535LL, llround(value / capacity * 10000)) : 0;
+    if(next == level[link]) return;
+    changes.push_back(make_pair(link, next - level[link]));
+    level[link] = next;
+}
+
+void UtilizationMonitor::allocated(vector<Flow*>& flows){
+    allocations++;
+    vector<int> current;
+    for(auto flow : flows) {
+        for(auto share : flow->linkShares) {
+            int id = share.first->id;
+            if(id < 0 || id >= rate.size() || topology->links[id] != share.first) continue;   // pseudo-links
+            if(stamp[id] != allocations) {
+                stamp[id] = allocations;
+                offered[id] = 0;
+                current.push_back(id);
+            }
+            offered[id] += flow->throughput * share.second;
+        }
+    }
+    vector<pair<int, int>> changes;
+    for(auto id : active) {     // went idle
+        if(stamp[id] != allocations) setRate(id, 0, changes);
+    }
+    active.clear();
+    for(auto id : current) {
+        Link* link = topology->links[id];     // its throughput counts frozen flows at the later fill levels
+        double value = isfinite(offered[id]) ? offered[id] : link->capacity;
+        setRate(id, value, changes);
+        if(value > 0) active.push_back(id);
+    }
+    writeChanges(changes);
+}
+
+void UtilizationMonitor::progress(double time){
+    now += time;
+}
+
+void UtilizationMonitor::finish(){
+    vector<pair<int, int>> changes;
+    for(auto id : active) {
+        setRate(id, 0, changes);
+    }
+    active.clear();
+    writeChanges(changes);
+    flush();
+    for(auto rankTask : ranks) {
+        rankTask->stateTime[rankTask->state] += now - rankTask->stateSince;
+        rankTask->stateSince = now;
+    }
+}
+
+void UtilizationMonitor::writeVarint(uint64_t value){
+    while(value >= 0x80) {
+        buffer.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back((uint8_t)value);
+}
+
+void UtilizationMonitor::writeChanges(vector<pair<int, int>>& changes){
+    if(!series.is_open() || changes.empty()) return;
+    sort(changes.begin(), changes.end());
+    long long ticks = llround(now / tick);
+    writeVarint(ticks - lastTick);
+    lastTick = ticks;
+    writeVarint(changes.size());
+    int previous = 0;
+    for(auto change : changes) {
+        writeVarint(change.first - previous);
+        previous = change.first;
+        int64_t delta = change.second;
+        writeVarint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));  // zigzag
+    }
+    if(buffer.size() >= (1 << 20)) flush();
+}
+
+void UtilizationMonitor::flush(){
+    if(!series.is_open() || buffer.empty()) return;
+    series.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    series.flush();
+    buffer.clear();
+}
+
+static int tierLevel(NodeType type){
+    switch(type) {
+        case HOST: return 0;
+        case NIC: case NVSWITCH: return 1;
+        case TOR: return 2;
+        case AGG: return 3;
+        case CORE: return 4;
+    }
+    return 0;
+}
+
+static const char* typeName(NodeType type){
+    switch(type) {
+        case HOST: return "host";
+        case NIC: return "NIC";
+        case NVSWITCH: return "NVSwitch";
+        case TOR: return "TOR";
+        case AGG: return "AGG";
+        case CORE: return "core";
+    }
+    return "?";
+}
+
+void UtilizationMonitor::print(){
+    double span = now - start;
+    cout << "Utilization over " << span << " s:" << endl;
+
+    // ranks: time per state, by job and stage
+    const char* states[] = {"PP wait (bubble)", "compute", "TP comm", "DP wait", "DP comm", "done"};
+    map<pair<Workload*, int>, vector<double>> stages;     // state times summed over the stage's ranks
+    map<pair<Workload*, int>, int> stageRanks;
+    for(auto rankTask : ranks) {
+        auto key = make_pair(rankTask->rank->workload, rankTask->rank->pp);
+        vector<double>& times = stages[key];
+        times.resize(6, 0);
+        for(int s = 0; s < 6; ++s) {
+            times[s] += rankTask->stateTime[s];
+        }
+        stageRanks[key]++;
+    }
+    for(auto& it : stages) {
+        Workload* workload = it.first.first;
+        double total = 0;
+        for(auto t : it.second) total += t;
+        cout << "  " << (workload->name.empty() ? "job" : workload->name) << " stage " << it.first.second;
+        cout << " (" << stageRanks[it.first] << " ranks):";
+        cout << fixed << setprecision(1);
+        for(int s = 0; s < 6; ++s) {
+            if(s > 0) cout << ",";
+            cout << " " << states[s] << " " << (total > 0 ? 100 * it.second[s] / total : 0) << "%";
+        }
+        cout << defaultfloat << setprecision(6) << endl;
+    }
+
+    // links: by tier and the busiest ones
+    map<string, double> tierCarried, tierCapacity, tierPeak;
+    map<string, int> tierLinks;
+    vector<pair<double, int>> busiest;
+    for(int id = 0; id < topology->links.size(); ++id) {
+        Link* link = topology->links[id];
+        NodeType a = link->src->type, b = link->dst->type;
+        if(tierLevel(a) > tierLevel(b)) swap(a, b);
+        string tier = string(typeName(a)) + "-" + typeName(b);
+        double utilization = link->capacity > 0 && span > 0 ? carried[id] / (link->capacity * span) : 0;
+        tierCarried[tier] += carried[id];
+        tierCapacity[tier] += link->capacity * span;
+        tierPeak[tier] = max(tierPeak[tier], utilization);
+        tierLinks[tier]++;
+        if(carried[id] > 0) busiest.push_back(make_pair(-utilization, id));
+    }
+    cout << "  Link tiers (average / busiest link):" << endl;
+    for(auto it : tierLinks) {
+        double average = tierCapacity[it.first] > 0 ? tierCarried[it.first] / tierCapacity[it.first] : 0;
+        cout << "    " << it.first << " (" << it.second << " links): " << fixed << setprecision(1);
+        cout << 100 * average << "% / " << 100 * tierPeak[it.first] << "%" << defaultfloat << setprecision(6) << endl;
+    }
+    sort(busiest.begin(), busiest.end());
+    if(busiest.size() > topLinks) busiest.resize(topLinks);
+    if(!busiest.empty()) cout << "  Busiest links:" << endl;
+    for(auto entry : busiest) {
+        Link* link = topology->links[entry.second];
+        cout << "    Link " << link->id << " (" << link->src->id << " -> " << link->dst->id << "): ";
+        cout << fixed << setprecision(1) << -100 * entry.first << "%" << defaultfloat << setprecision(6) << endl;
+    }
+    if(!seriesPath.empty()) cout << "  Time series: " << seriesPath << endl;
+}
@@ -0,0 +1,64 @@
+#ifndef UTILIZATION_H
+#define UTILIZATION_H
+
+#include "common.h"
+#include "simulator.h"
+#include "topology.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+using namespace std;
+
+// Streaming utilization accounting. Ranks add the time spent in each
+// RankState at their transitions; links integrate their throughput when an
+// allocation changes it, touching only the links of the active flows and
+// those that just went idle. Nothing is sampled per round.
+//
+// The optional time series is a binary file of utilization changes:
+//   header:  "UTS1", varint link count, float64 tick (seconds)
+//   record:  varint ticks since the previous record, varint changed links,
+//            then per link (ascending id) varint id delta and zigzag varint
+//            level delta against the link's previous level
+// Levels are utilization in basis points (1/10000 of capacity), all links
+// start at 0.
+class UtilizationMonitor {
+public:
+    Topology* topology;
+    string seriesPath;      // empty: no time series
+    double tick;            // time resolution of the series
+    int topLinks;
+    UtilizationMonitor(Topology* topology, const string& seriesPath = "", double tick = 1e-9, int topLinks = 10);
+    ~UtilizationMonitor();
+
+    double now;
+    vector<RankTask*> ranks;
+    void attach(vector<Task*>& tasks);
+
+    // per link id
+    vector<double> rate, since, carried;    // carried: bytes
+    vector<double> offered; // in the current allocation, what its flows put on the link
+    vector<int> level, stamp;
+    vector<int> active;     // links with a nonzero rate
+    int allocations;
+    double start;           // of the accounting
+
+    void allocated(vector<Flow*>& flows);
+    void setRate(int link, double rate, vector<pair<int, int>>& changes);
+    void progress(double time);
+    void finish();          // closes the accumulators at now
+
+    // time series
+    ofstream series;
+    vector<uint8_t> buffer;
+    long long lastTick;
+    void writeVarint(uint64_t value);
+    void writeChanges(vector<pair<int, int>>& changes);
+    void flush();
+
+    void print();
+};
+
+#endif // UTILIZATION_H
@@ -6,6 +6,10 @@
 #include <map>
 #include <tuple>
 #include <algorithm>
+#include <limits>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
 
 
 using namespace std;
@@ -62,6 +66,15 @@ void Workload::print(){
     cout << "Forward PP Size: " << fwdPPSize << endl;
     cout << "Backward PP Size: " << bwdPPSize << endl;
     cout << "DP Size: " << dpSize << endl;
+    cout << "Stage table (fwdComp bwdComp fwdTP bwdTP fwdPP bwdPP dp):" << endl;
+    for(int i = 0; i < PP; ++i) {
+        cout << "  Stage " << i << ": " << stageFwdCompTime[i] << " " << stageBwdCompTime[i] << " "
+             << stageFwdTPSize[i] << " " << stageBwdTPSize[i] << " "
+             << stageFwdPPSize[i] << " " << stageBwdPPSize[i] << " " << stageDPSize[i] << endl;
+    }
+    for(auto it : microbatchScale) {
+        cout << "  Microbatch " << it.first << " scale: " << it.second << endl;
+    }
 
     cout << "--------------------------------" << endl;
     cout << "Ranks:" << endl;
@@ -80,98 +93,343 @@ void Workload::print(){
 
 
 
+Workload::Workload() : PP(0), DP(0), TP(0), microbatches(0), fwdCompTime(0), bwdCompTime(0),
+    fwdTPSize(0), bwdTPSize(0), fwdPPSize(0), bwdPPSize(0), dpSize(0) {
+}
+
 Workload::Workload(int PP, int DP, int TP, int microbatches, 
     double fwdCompTime, double bwdCompTime, double fwdTPSize, double bwdTPSize, 
     double fwdPPSize, double bwdPPSize, double dpSize) :   
     PP(PP), DP(DP), TP(TP), microbatches(microbatches), fwdCompTime(fwdCompTime), bwdCompTime(bwdCompTime),
     fwdTPSize(fwdTPSize), bwdTPSize(bwdTPSize), fwdPPSize(fwdPPSize), bwdPPSize(bwdPPSize), dpSize(dpSize) {
+
+    // uniform stage tables, may be overridden by loadProfile
+    stageFwdCompTime.assign(PP, fwdCompTime);
+    stageBwdCompTime.assign(PP, bwdCompTime);
+    stageFwdTPSize.assign(PP, fwdTPSize);
+    stageBwdTPSize.assign(PP, bwdTPSize);
+    stageFwdPPSize.assign(PP, fwdPPSize);
+    stageBwdPPSize.assign(PP, bwdPPSize);
+    stageDPSize.assign(PP, dpSize);
+    stageActivationMemory.assign(PP, 0);
+    stageStaticMemory.assign(PP, 0);
     
-    // create ranks
-    map<tuple<int, int, int>, Rank*> rankMap; // PP, DP, TP
+    // ranks, groups and connections in contiguous arrays, indexed arithmetically:
+    // rank (pp, dp, tp) is rankId(); TP groups (pp, dp), then DP groups (pp, tp),
+    // then a forward and a backward PP group per (dp, tp) chain and stage boundary
+    int N = PP * DP * TP;
+    int chains = DP * TP * max(PP - 1, 0);
+    rankArray.reserve(N);
+    groupArray.reserve(PP * DP + PP * TP + 2 * chains);
+    connectionArray.reserve(2 * N + 2 * chains);
+    groupRanks.resize(2 * N + 4 * chains);
+    groupConnections.resize(2 * N + 2 * chains);
+    ranks.reserve(N);
+    groups.reserve(groupArray.capacity());
 
-    int rankId = 0;
     for(int i = 0; i < PP; ++i) {
         for(int j = 0; j < DP; ++j) {
             for(int k = 0; k < TP; ++k) {
-                Rank* rank = new Rank(rankId++, i, j, k);
+                rankArray.emplace_back(ranks.size(), i, j, k);
+                Rank* rank = &rankArray.back();
+                rank->workload = this;
+                rank->ppFwdGroup = rank->ppBwdGroup = nullptr;
                 ranks.push_back(rank);
-                rankMap[make_tuple(i, j, k)] = rank; // PP, DP, TP
             }
         }
     }
-    
-    // create groups
 
-    map<tuple<int, int, int>, Group*> groupMap; // PP, DP, TP
-
-    int groupId = 0;
-    for(int i = 0; i < PP; ++i) { 
-        for(int j = 0; j < DP; ++j) {   // TP
-            Group* group = new Group(groupId++, GroupType::TP, i, j, -1);
-            groups.push_back(group);
-            groupMap[make_tuple(i, j, -1)] = group; // TP group
+    int member = 0;
+    auto addGroup = [&](GroupType type, int pp, int dp, int tp, int size) {
+        groupArray.emplace_back(groups.size(), type, pp, dp, tp);
+        Group* group = &groupArray.back();
+        group->workload = this;
+        group->pooled = true;
+        group->ranks.attach(&groupRanks[member], size);
+        member += size;
+        groups.push_back(group);
+        return group;
+    };
+    auto connect = [&](Group* group, int count) {   // ring, or the one PP connection
+        int first = connectionArray.size();
+        for(int i = 0; i < count; ++i) {
+            connectionArray.emplace_back(group->ranks[i], group->ranks[(i + 1) % group->ranks.size()]);
+            groupConnections[first + i] = &connectionArray.back();
+        }
+        group->connections.attach(&groupConnections[first], count);
+    };
+    for(int i = 0; i < PP; ++i) {
+        for(int j = 0; j < DP; ++j) {
+            Group* group = addGroup(GroupType::TP, i, j, -1, TP);
+            for(int k = 0; k < TP; ++k) {
+                Rank* rank = rankAt(i, j, k);
+                rank->tpGroup = group;
+                group->ranks[k] = rank;
+            }
+            connect(group, TP);
         }
     }
-
-    for(int i = 0; i < PP; ++i) { 
-        for(int j = 0; j < TP; ++j) {   // DP
-            Group* group = new Group(groupId++, GroupType::DP, i, -1, j);
-            groups.push_back(group);
-            groupMap[make_tuple(i, -1, j)] = group; // DP group
+    for(int i = 0; i < PP; ++i) {
+        for(int k = 0; k < TP; ++k) {
+            Group* group = addGroup(GroupType::DP, i, -1, k, DP);
+            for(int j = 0; j < DP; ++j) {
+                Rank* rank = rankAt(i, j, k);
+                rank->dpGroup = group;
+                group->ranks[j] = rank;
+            }
+            connect(group, DP);
+        }
+    }
+    for(int j = 0; j < DP; ++j) {
+        for(int k = 0; k < TP; ++k) {
+            for(int i = 0; i < PP - 1; ++i) {
+                Rank* r1 = rankAt(i, j, k);
+                Rank* r2 = rankAt(i + 1, j, k);
+                Group* fwdGroup = addGroup(GroupType::PP, i, k, j, 2);
+                fwdGroup->ranks[0] = r1;
+                fwdGroup->ranks[1] = r2;
+                connect(fwdGroup, 1);
+                Group* bwdGroup = addGroup(GroupType::PP, i + 1, k, j, 2);
+                bwdGroup->ranks[0] = r2;
+                bwdGroup->ranks[1] = r1;
+                connect(bwdGroup, 1);
+                r1->ppFwdGroup = fwdGroup;
+                r2->ppBwdGroup = bwdGroup;
+            }
         }
     }
+}
 
-    // associate ranks and groups
-    for(auto rank : ranks) {
-        int pp = rank->pp;
-        int dp = rank->dp;
-        int tp = rank->tp;
 
-        // TP group
-        Group* tpGroup = groupMap[make_tuple(pp, dp, -1)];
-        rank->tpGroup = tpGroup;
-        tpGroup->ranks.push_back(rank);
+Workload* Workload::replicate(Topology* topology){
+    Workload* copy = new Workload(PP, DP, TP, microbatches, fwdCompTime, bwdCompTime,
+                                  fwdTPSize, bwdTPSize, fwdPPSize, bwdPPSize, dpSize);
+    copy->stageFwdCompTime = stageFwdCompTime;
+    copy->stageBwdCompTime = stageBwdCompTime;
+    copy->stageFwdTPSize = stageFwdTPSize;
+    copy->stageBwdTPSize = stageBwdTPSize;
+    copy->stageFwdPPSize = stageFwdPPSize;
+    copy->stageBwdPPSize = stageBwdPPSize;
+    copy->stageDPSize = stageDPSize;
+    copy->stageActivationMemory = stageActivationMemory;
+    copy->stageStaticMemory = stageStaticMemory;
+    copy->activationMode = activationMode;
+    copy->offloadBandwidth = offloadBandwidth;
+    copy->memoryCapacity = memoryCapacity;
+    copy->microbatchScale = microbatchScale;
+    copy->name = name;
+    copy->arrivalTime = arrivalTime;
+    copy->iterations = iterations;
+    copy->railAligned = railAligned;
+    copy->launchOverhead = launchOverhead;
+    copy->stepOverhead = stepOverhead;
+    copy->chunkSize = chunkSize;
+    copy->inNetworkAggregation = inNetworkAggregation;
+    copy->topology = topology;
+    for(auto host : hosts) {
+        copy->hosts.push_back(topology->nodes[host->id]);
+    }
+    copy->configureParallelism();
+    copy->placement();
+    return copy;
+}
+
+double Workload::getCompTime(int pp, int microbatch){
+    double time = microbatch > 0 ? stageFwdCompTime[pp] : stageBwdCompTime[pp];
+    if(microbatch < 0 && activationMode == RECOMPUTE) time += stageFwdCompTime[pp];
+    auto it = microbatchScale.find(abs(microbatch));
+    return it == microbatchScale.end() ? time : time * it->second;
+}
+
+double Workload::getTPSize(int pp, int microbatch){
+    double size = microbatch > 0 ? stageFwdTPSize[pp] : stageBwdTPSize[pp];
+    auto it = microbatchScale.find(abs(microbatch));
+    return it == microbatchScale.end() ? size : size * it->second;
+}
+
+double Workload::getPPSize(int pp, int microbatch){ // pp: sending stage
+    double size = microbatch > 0 ? stageFwdPPSize[pp] : stageBwdPPSize[pp];
+    auto it = microbatchScale.find(abs(microbatch));
+    return it == microbatchScale.end() ? size : size * it->second;
+}
+
+double Workload::getDPSize(int pp){
+    return stageDPSize[pp];
+}
 
-        // DP group
-        Group* dpGroup = groupMap[make_tuple(pp, -1, tp)];
-        rank->dpGroup = dpGroup;
-        dpGroup->ranks.push_back(rank);
+double Workload::getActivationMemory(int pp, int microbatch){
+    double size = stageActivationMemory[pp];
+    auto it = microbatchScale.find(abs(microbatch));
+    return it == microbatchScale.end() ? size : size * it->second;
+}
+
+// Recomputation keeps only the stage input, the activation received from
+// the previous stage.
+double Workload::getStoredMemory(int pp, int microbatch){
+    if(activationMode != RECOMPUTE) return getActivationMemory(pp, microbatch);
+    return pp > 0 ? min(getPPSize(pp - 1, abs(microbatch)), getActivationMemory(pp, microbatch)) : 0;
+}
+
+// Walks the stage's 1F1B order: forwards add what they keep, backwards
+// free it, a recomputing backward briefly holds the full activations.
+// Offload is timed, see offloadPeak; the walk without offload bounds it.
+double Workload::peakMemory(int pp){
+    double live = 0, peak = 0;
+    int mb = 1;
+    while(true) {
+        double activation = getActivationMemory(pp, mb);
+        if(mb > 0) {
+            live += getStoredMemory(pp, mb);
+            peak = max(peak, live);
+        }
+        else {
+            peak = max(peak, live - getStoredMemory(pp, mb) + activation);
+            live -= getStoredMemory(pp, mb);
+        }
+        auto it = nextMicrobatch.find(make_tuple(pp, mb));
+        if(it == nextMicrobatch.end()) break;
+        mb = it->second;
     }
-    
-    // enumerate nodes 
-
-    for(int j = 0; j < DP; ++j) {               // DP
-        for(int i = 0; i < TP; ++i) {           // TP
-            Rank* first = rankMap[make_tuple(0, j, i)];
-            Rank* last = rankMap[make_tuple(PP-1, j, i)];
-            first->ppBwdGroup = nullptr;  // Changed from == to =
-            last->ppFwdGroup = nullptr;
-            for(int k = 0; k < PP - 1; ++k) {  // PP
-                // cout << "PP, TP, DP; k: " << k << ", i: " << i << ", j: " << j << endl;
-                Group *fwdGroup = new Group(groupId++, GroupType::PP, k, i, j);
-                Group *bwdGroup = new Group(groupId++, GroupType::PP, k+1, i, j);
-                Rank* r1 = rankMap[make_tuple(k, j, i)];
-                Rank* r2 = rankMap[make_tuple(k+1, j, i)];
-                fwdGroup->ranks.push_back(r1);
-                fwdGroup->ranks.push_back(r2);
-                bwdGroup->ranks.push_back(r2);
-                bwdGroup->ranks.push_back(r1);
-                r1->ppFwdGroup = fwdGroup;
-                r2->ppBwdGroup = bwdGroup;
-                groups.push_back(fwdGroup);
-                groups.push_back(bwdGroup);
+    if(activationMode == OFFLOAD) peak = min(peak, offloadPeak(pp));
+    return stageStaticMemory[pp] + peak;
+}
+
+// Offload: the stage's ops back to back, the copies serialized on each
+// PCIe direction at offloadBandwidth. Activations are held from the
+// forward's start until its copy out ends, and again from the copy back,
+// issued once the backward is next, until the backward ends. Waiting on
+// other stages only gives the copies more time. Servers with NICs share
+// the PCIe link with network traffic, so there is no such bound.
+double Workload::offloadPeak(int pp){
+    if(topology != nullptr) {
+        for(auto node : topology->nodes) {
+            if(node->type == NIC) return numeric_limits<double>::infinity();
+        }
+    }
+    vector<pair<double, double>> changes;   // < time, bytes >
+    map<int, double> offloadEnd;
+    double clock = 0, outFree = 0, inFree = 0;
+    int mb = 1;
+    while(true) {
+        double activation = getActivationMemory(pp, mb);
+        auto it = nextMicrobatch.find(make_tuple(pp, mb));
+        if(mb > 0) {
+            changes.push_back(make_pair(clock, activation));
+            clock += getCompTime(pp, mb);
+            if(it != nextMicrobatch.end() && it->second != -mb) {
+                outFree = max(clock, outFree) + activation / offloadBandwidth;
+                offloadEnd[mb] = outFree;
+                changes.push_back(make_pair(outFree, -activation));
+            }
+        }
+        else {
+            auto offloaded = offloadEnd.find(-mb);
+            if(offloaded != offloadEnd.end()) {
+                double start = max(max(clock, offloaded->second), inFree);
+                changes.push_back(make_pair(start, activation));
+                inFree = start + activation / offloadBandwidth;
+                clock = max(clock, inFree);
             }
+            clock += getCompTime(pp, mb);
+            changes.push_back(make_pair(clock, -activation));
         }
+        if(it == nextMicrobatch.end()) break;
+        mb = it->second;
     }
-    
-    // create connections
+    sort(changes.begin(), changes.end(), [](const pair<double, double>& a, const pair<double, double>& b) {
+        return a.first < b.first || (a.first == b.first && a.second > b.second);  // allocations first
+    });
+    double live = 0, peak = 0;
+    for(auto& change : changes) {
+        live += change.second;
+        peak = max(peak, live);
+    }
+    return peak;
+}
 
-    for(auto group : groups) {
-        group->createConnections();
+bool Workload::fitsMemory(){
+    if(memoryCapacity <= 0) return true;
+    for(int pp = 0; pp < PP; ++pp) {
+        if(peakMemory(pp) > memoryCapacity) return false;
+    }
+    return true;
+}
+
+// Profile format, one record per line, '#' starts a comment:
+//   stage <pp> <fwdComp> <bwdComp> <fwdTP> <bwdTP> <fwdPP> <bwdPP> <dp>
+//   microbatch <mb> <scale>
+//   memory <pp> <activation> <static>
+// Other record types (e.g. "layer", used by StageBalancer) are ignored.
+bool Workload::loadProfile(const string& path){
+    ifstream in(path);
+    if(!in.is_open()) {
+        cerr << "Cannot open profile " << path << endl;
+        return false;
+    }
+    string line;
+    int lineNo = 0;
+    while(getline(in, line)) {
+        lineNo++;
+        line = line.substr(0, line.find('#'));
+        istringstream ss(line);
+        string kind;
+        if(!(ss >> kind)) continue;
+        if(kind == "stage") {
+            int pp;
+            double v[7];
+            if(!(ss >> pp >> v[0] >> v[1] >> v[2] >> v[3] >> v[4] >> v[5] >> v[6]) || pp < 0 || pp >= PP) {
+                cerr << "Invalid stage record at " << path << ":" << lineNo << endl;
+                return false;
+            }
+            stageFwdCompTime[pp] = v[0];
+            stageBwdCompTime[pp] = v[1];
+            stageFwdTPSize[pp] = v[2];
+            stageBwdTPSize[pp] = v[3];
+            stageFwdPPSize[pp] = v[4];
+            stageBwdPPSize[pp] = v[5];
+            stageDPSize[pp] = v[6];
+        }
+        else if(kind == "microbatch") {
+            int mb;
+            double scale;
+            if(!(ss >> mb >> scale) || mb < 1 || mb > microbatches) {
+                cerr << "Invalid microbatch record at " << path << ":" << lineNo << endl;
+                return false;
+            }
+            microbatchScale[mb] = scale;
+        }
+        else if(kind == "memory") {
+            int pp;
+            double activation, fixed;
+            if(!(ss >> pp >> activation >> fixed) || pp < 0 || pp >= PP) {
+                cerr << "Invalid memory record at " << path << ":" << lineNo << endl;
+                return false;
+            }
+            stageActivationMemory[pp] = activation;
+            stageStaticMemory[pp] = fixed;
+        }
     }
+    return true;
+}
+
 
+Group::~Group() {
+    if(!pooled) {   // otherwise owned by the workload's arrays
+        for(auto connection : connections) {
+            delete connection;
+        }
+    }
+    for(auto connection : aggregation) {
+        delete connection;
+    }
 }
 
+void Workload::rankFinished(int iteration){
+    if(finishedRanks.size() <= iteration) {
+        finishedRanks.resize(iteration + 1, 0);
+    }
+    finishedRanks[iteration]++;
+}
 
 void Group::createConnections() {
     // TP or DP
@@ -261,21 +519,29 @@ void Workload::configureParallelism(){
 
 
 void Workload::placement(){
-    // sort rank 
-    sort(ranks.begin(), ranks.end(), [](Rank* a, Rank* b) {
+    // sort rank, built in id order unless replayed from a trace
+    auto byId = [](Rank* a, Rank* b) {
         return a->id < b->id;
-    });
+    };
+    if(!is_sorted(ranks.begin(), ranks.end(), byId)) sort(ranks.begin(), ranks.end(), byId);
 
     // sort host 
-    vector<Node*> hosts;
-    for(auto node : topology->nodes) {
-        if(node->type == NodeType::HOST) {
-            hosts.push_back(node);
+    vector<Node*> hosts = this->hosts;
+    if(hosts.empty()) {
+        for(auto node : topology->nodes) {
+            if(node->type == NodeType::HOST) {
+                hosts.push_back(node);
+            }
         }
     }
-    sort(hosts.begin(), hosts.end(), [](Node* a, Node* b) {
+    auto hostOrder = [](Node* a, Node* b) {
         return a->id < b->id;
-    });
+    };
+    if(!is_sorted(hosts.begin(), hosts.end(), hostOrder)) sort(hosts.begin(), hosts.end(), hostOrder);
+    if(railAligned && trace == nullptr) {
+        railPlacement(hosts);
+        return;
+    }
 
     // mapping
     for(int i = 0; i < ranks.size(); ++i) {
@@ -285,26 +551,148 @@ void Workload::placement(){
         host->rank = rank;
     }
 }
+
+// TP groups are packed into servers with the TP index on the same local GPU
+// in every server, so DP and PP peers (same tp) share a rail when their
+// groups also sit at the same offset in their servers. TP groups larger than
+// a server span whole servers. Smaller ones all use offset 0, one per
+// server, if there are enough servers; otherwise a stage's groups share an
+// offset, keeping DP on its rails while PP crosses them, and failing that
+// groups are packed in order with neither aligned.
+void Workload::railPlacement(vector<Node*>& hosts){
+    map<int, vector<Node*>> servers;  // server -> GPUs by local index
+    for(auto host : hosts) {
+        servers[host->server].push_back(host);
+    }
+    vector<vector<Node*>> serverGPUs;
+    for(auto& it : servers) {
+        sort(it.second.begin(), it.second.end(), [](Node* a, Node* b) {
+            return a->gpu < b->gpu;
+        });
+        serverGPUs.push_back(it.second);
+    }
+    int G = serverGPUs[0].size();
+    int S = serverGPUs.size();
+
+    int groups = PP * DP;   // TP groups
+    int serversPerGroup = TP >= G ? (TP + G - 1) / G : 1;
+    int groupsPerServer = TP >= G ? 1 : G / TP;
+    int stagesPerServer = min(groupsPerServer, PP);     // offsets a server's groups take, by stage
+    bool aligned = TP >= G || groups <= S;
+    bool dpAligned = !aligned && (PP + stagesPerServer - 1) / stagesPerServer * DP <= S;
+    if(!aligned) {
+        cerr << "Rail placement: " << groups << " TP groups of " << TP << " on " << S << " servers of " << G << " GPUs, "
+             << (dpAligned ? "PP" : "DP and PP") << " peers cross rails" << endl;
+    }
+    for(auto rank : ranks) {
+        int g = rank->pp * DP + rank->dp;
+        int server, gpu;
+        if(TP >= G) {
+            server = g * serversPerGroup + rank->tp / G;
+            gpu = rank->tp % G;
+        }
+        else if(aligned) {
+            server = g;
+            gpu = rank->tp;
+        }
+        else if(dpAligned) {
+            server = rank->pp / stagesPerServer * DP + rank->dp;
+            gpu = rank->pp % stagesPerServer * TP + rank->tp;
+        }
+        else {
+            server = g / groupsPerServer;
+            gpu = g % groupsPerServer * TP + rank->tp;
+        }
+        vector<Node*>& gpus = serverGPUs[server % serverGPUs.size()];
+        Node* host = gpus[gpu % gpus.size()];
+        rank->host = host;
+        host->rank = rank;
+    }
+}
 void Workload::routing(){
     // iterate on connections
     for(auto group : groups) {
         for(auto conn : group->connections) {
-            Node* src = conn->src->host;
-            Node* dst = conn->dst->host;
-            vector<Node*> path = topology->ECMP(src, dst);
-            conn->path = path;
-            for(int i = 0; i < path.size() - 1; ++i) {
-                Node* src = path[i];
-                Node* dst = path[i + 1];
-                for(auto link : src->links) {
-                    if(link->src == src && link->dst == dst) {
-                        conn->pathLinks.push_back(link);
-                        break;
-                    }
-                }
-            }
+            routeConnection(conn);
+        }
+        if(inNetworkAggregation && group->type == GroupType::DP && group->ranks.size() > 1) {
+            routeAggregation(group);
+        }
+    }
+    if(activationMode == OFFLOAD) routeOffload();
+}
+
+// Per rank, a PP-like group to itself for each PCIe direction: activations
+// go out to host memory after the forward and come back before the backward.
+void Workload::routeOffload(){
+    for(auto rank : ranks) {
+        if(rank->offloadGroup != nullptr) continue;
+        for(int toGpu = 0; toGpu < 2; ++toGpu) {
+            Group* group = new Group(groups.size(), GroupType::PP, rank->pp, rank->dp, rank->tp);
+            group->workload = this;
+            group->ranks.push_back(rank);
+            group->ranks.push_back(rank);
+            Connection* conn = new Connection(rank, rank);
+            Link* link = topology->pcieLink(rank->host, toGpu, offloadBandwidth);
+            conn->pathLinks.push_back(link);
+            conn->linkShares.push_back(make_pair(link, 1.0));
+            group->connections.push_back(conn);
+            groups.push_back(group);
+            if(toGpu) rank->reloadGroup = group;
+            else rank->offloadGroup = group;
         }
     }
 }
 
+// One connection per rank carrying its shares of the group's reduction
+// tree; without a tree the group keeps the ring.
+void Workload::routeAggregation(Group* group){
+    for(auto connection : group->aggregation) {
+        delete connection;
+    }
+    group->aggregation.clear();
+    vector<Node*> hosts;
+    for(auto rank : group->ranks) {
+        hosts.push_back(rank->host);
+    }
+    vector<vector<pair<Link*, double>>> shares;
+    if(!topology->aggregationTree(hosts, shares)) return;
+    for(int i = 0; i < group->ranks.size(); ++i) {
+        Connection* conn = new Connection(group->ranks[i], group->ranks[i]);
+        conn->linkShares = shares[i];
+        for(auto share : shares[i]) {
+            conn->pathLinks.push_back(share.first);
+        }
+        group->aggregation.push_back(conn);
+    }
+}
 
+void Workload::routeConnection(Connection* conn){
+    if(conn->src == conn->dst && !conn->linkShares.empty()) return;    // fixed shares within the rank (PCIe)
+    Node* src = conn->src->host;
+    Node* dst = conn->dst->host;
+    conn->linkShares.clear();
+    conn->pathLinks.clear();
+    if(topology->multipath != SINGLE_PATH) {
+        conn->path.clear();
+        conn->linkShares = topology->spray(src, dst, topology->multipathWidth);
+        // adaptive splits may move onto any equal-cost path later
+        vector<pair<Link*, double>> links = topology->multipath == ADAPTIVE ? topology->spray(src, dst, 0) : conn->linkShares;
+        for(auto share : links) {
+            conn->pathLinks.push_back(share.first);
+        }
+        return;
+    }
+    vector<Node*> path = topology->ECMP(src, dst);
+    conn->path = path;
+    for(int i = 0; i + 1 < path.size(); ++i) {
+        Node* src = path[i];
+        Node* dst = path[i + 1];
+        for(auto link : src->links) {
+            if(link->src == src && link->dst == dst) {
+                conn->pathLinks.push_back(link);
+                break;
+            }
+        }
+    }
+}
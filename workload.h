@@ -8,6 +8,7 @@
 #include <iostream>
 #include <map>
 #include <set>
+#include <string>
 
 using namespace std;
 
@@ -22,6 +23,33 @@ class Collective;
 class Flow;
 class Link;
 class Topology;
+class TraceReader;
+
+// Member pointers of a group: a slice of one of the workload's contiguous
+// arrays for 1F1B jobs, or its own storage once built or changed one by one.
+template<class T>
+class Members {
+public:
+    Members() : first(nullptr), count(0) {}
+    void attach(T* data, int size) { own.clear(); first = data; count = size; }
+    T* begin() { return first != nullptr ? first : own.data(); }
+    T* end() { return begin() + size(); }
+    size_t size() const { return first != nullptr ? count : own.size(); }
+    bool empty() const { return size() == 0; }
+    T& operator[](size_t i) { return begin()[i]; }
+    T& front() { return begin()[0]; }
+    T& back() { return begin()[size() - 1]; }
+    void push_back(const T& value) {
+        if(first != nullptr) own.assign(first, first + count);
+        first = nullptr;
+        own.push_back(value);
+    }
+    void clear() { first = nullptr; count = 0; own.clear(); }
+private:
+    T* first;
+    int count;
+    vector<T> own;
+};
 
 class Rank {
 public:
@@ -30,7 +58,9 @@ public:
     Rank(int id, int pp, int dp, int tp) : id(id), pp(pp), dp(dp), tp(tp) {}
 
     Group *tpGroup, *ppFwdGroup, *ppBwdGroup, *dpGroup;
+    Group *offloadGroup = nullptr, *reloadGroup = nullptr;  // activation offload over PCIe
     Node* host;
+    Workload* workload;
 
     // simulator related
     RankTask* rankTask;
@@ -46,9 +76,13 @@ public:
     Group(int id, GroupType type, int pp, int dp, int tp) : id(id), type(type), pp(pp), dp(dp), tp(tp) {
 
     }
+    ~Group();
+    bool pooled = false;    // in the workload's arrays, with its connections
     
-    vector<Rank*> ranks;  // directed links from Group
-    vector<Connection*> connections;  // directed links from Group
+    Workload* workload;
+    Members<Rank*> ranks;  // directed links from Group
+    Members<Connection*> connections;  // directed links from Group
+    vector<Connection*> aggregation;  // DP in-network reduction: per rank, shares of the switch tree
     void createConnections();
 
     // simulator related
@@ -64,7 +98,8 @@ public:
     Connection(Rank* src, Rank* dst) : src(src), dst(dst) {}
 
     vector<Node*> path;
-    vector<Link*> pathLinks;
+    vector<Link*> pathLinks;                 // multipath: every link that may carry traffic
+    vector<pair<Link*, double>> linkShares;  // multipath: fraction of the traffic per link
 
     void print();
 };
@@ -83,23 +118,82 @@ public:
     double fwdPPSize, bwdPPSize;
     double dpSize; 
 
+    // per-stage tables (indexed by PP stage), initialized from the scalars above
+    // PP sizes are indexed by the sending stage
+    vector<double> stageFwdCompTime, stageBwdCompTime;
+    vector<double> stageFwdTPSize, stageBwdTPSize;
+    vector<double> stageFwdPPSize, stageBwdPPSize;
+    vector<double> stageDPSize;
+    map<int, double> microbatchScale;   // microbatch id (>0) -> scale on compute and TP/PP sizes
+
+    double getCompTime(int pp, int microbatch);
+    double getTPSize(int pp, int microbatch);
+    double getPPSize(int pp, int microbatch);
+    double getDPSize(int pp);
+    bool loadProfile(const string& path);
+
+    // activation memory per rank
+    vector<double> stageActivationMemory;   // bytes a microbatch's forward leaves for its backward
+    vector<double> stageStaticMemory;       // weights, gradients and optimizer state
+    ActivationMode activationMode = STORE_ACTIVATIONS;
+    double offloadBandwidth = 32e9;         // PCIe bytes/s when the GPU has no NIC link to share
+    double memoryCapacity = 0;              // per GPU, 0: unchecked
+    double getActivationMemory(int pp, int microbatch);
+    double getStoredMemory(int pp, int microbatch);     // kept between forward and backward
+    double peakMemory(int pp);              // from the 1F1B schedule, before simulating
+    double offloadPeak(int pp);
+    bool fitsMemory();
+
     Workload(int PP, int DP, int TP, int microbatches, double fwdCompTime, double bwdCompTime,
              double fwdTPSize, double bwdTPSize, double fwdPPSize, double bwdPPSize, double dpSize);
+    Workload();   // empty, ranks and groups are filled by a trace
+    TraceReader* trace = nullptr;   // trace-driven replay instead of 1F1B
+    Workload* replicate(Topology* topology);  // same job placed on a copy of the topology, not routed
+
+    // multi-job simulation
+    string name;
+    double arrivalTime = 0;
+    int iterations = 1;
+    vector<int> finishedRanks;      // per iteration
+    vector<double> iterationEnds;   // global time each iteration completed
+    void rankFinished(int iteration);
     ~Workload() {
         for (auto rank : ranks) {
-            delete rank;
+            if (rankArray.empty()) delete rank;
         }
         for (auto group : groups) {
-            delete group;
+            if (!group->pooled) delete group;
         }
     }
+
+    // 1F1B jobs keep ranks, groups and connections contiguous; ranks and
+    // groups point into these, trace jobs and later groups are allocated one by one
+    vector<Rank> rankArray;
+    vector<Group> groupArray;
+    vector<Connection> connectionArray;
+    vector<Rank*> groupRanks;               // members of every group, one slice per group
+    vector<Connection*> groupConnections;
+    int rankId(int pp, int dp, int tp) { return (pp * DP + dp) * TP + tp; }
+    Rank* rankAt(int pp, int dp, int tp) { return ranks[rankId(pp, dp, tp)]; }
     
     map<tuple<int, int>, int> nextMicrobatch;
     void configureParallelism();
 
     Topology *topology;
+    vector<Node*> hosts;   // hosts owned by this job, empty: all hosts
+    bool railAligned = false;   // keep TP in a server and DP/PP peers on the same rail
+
+    // alpha-beta latency of the collective library
+    double launchOverhead = 0;  // per collective
+    double stepOverhead = 0;    // per algorithm step (software/synchronization)
+    double chunkSize = 0;       // pipelining chunk, adds store-and-forward per hop; 0: off
+    bool inNetworkAggregation = false;  // DP all-reduce on a switch reduction tree when one is free
     void placement();
+    void railPlacement(vector<Node*>& hosts);
     void routing();
+    void routeConnection(Connection* conn);
+    void routeAggregation(Group* group);
+    void routeOffload();
     
     void print();
 };